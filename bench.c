@@ -0,0 +1,384 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Accuracy and speed of the FFT kernels in int_fft.c and fft.c.
+ * Every kernel runs on a tone, noise and a full scale tone, at each
+ * power of two size it supports, cfft() also at a few mixed radix and
+ * prime sizes, and is compared against a double precision
+ * reference. One CSV line per kernel, size and input:
+ *
+ *	kernel,n,input,us_per_call,msamples_per_s,snr_db,max_err
+ *
+ * For the transforms max_err is the largest bin error in LSB of the
+ * 1/n scaled spectrum, for the windows in LSB of the input, for the
+ * dB conversions in dB. snr_db is left empty for the dB conversions.
+ *
+ * Usage: fft_bench [log2 of the largest cfft() size, default 16]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define BENCH_MIN_TIME	0.05	/* seconds per measurement */
+#define BENCH_DFT_MAX	8192	/* larger powers of two use the double FFT */
+#define FIX_FFT_MAX	10	/* Sinewave[] length */
+
+enum {
+	INPUT_TONE,
+	INPUT_NOISE,
+	INPUT_FULL_SCALE,
+	INPUT_NUM,
+};
+
+static const char *input_name[INPUT_NUM] = { "tone", "noise", "full_scale" };
+
+/* cfft() sizes that are not powers of two, ascending */
+static const int odd_size[] = { 24, 1000, 1009, 6144, 7919, 10000 };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Test signals in Q15 codes. The tone is half scale and between bins,
+ * so it leaks into the whole spectrum; the noise is uniform over 14
+ * bits, like the ADC; the full scale tone is bin centred at 32767.
+ */
+static void make_input(double *x, int n, int type)
+{
+	unsigned seed = 12345;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		switch (type) {
+		case INPUT_TONE:
+			x[i] = 16384 * cos(2 * M_PI * 0.1173 * i + 0.3);
+			break;
+		case INPUT_NOISE:
+			seed = seed * 1103515245 + 12345;
+			x[i] = (int)((seed >> 16) & 0x3fff) - 8192;
+			break;
+		default:
+			x[i] = 32767 * cos(2 * M_PI * i / 8);
+			break;
+		}
+		x[i] = rint(x[i]);
+	}
+}
+
+/* direct DFT with an exact twiddle table, O(n^2) */
+static void ref_dft(double *yr, double *yi, const double *x, int n)
+{
+	double *c = malloc(2 * n * sizeof(double)), *s = c + n, ar, ai;
+	int i, k, m;
+
+	for (i = 0; i < n; i++) {
+		c[i] = cos(2 * M_PI * i / n);
+		s[i] = -sin(2 * M_PI * i / n);
+	}
+
+	for (k = 0; k < n; k++) {
+		ar = ai = 0;
+		for (i = 0, m = 0; i < n; i++, m = (m + k) % n) {
+			ar += x[i] * c[m];
+			ai += x[i] * s[m];
+		}
+		yr[k] = ar;
+		yi[k] = ai;
+	}
+
+	free(c);
+}
+
+/* radix 2 FFT in double, twiddles computed directly for each index */
+static void ref_fft(double *yr, double *yi, const double *x, int n)
+{
+	double tr, ti, cr, ci;
+	int i, j, k, l;
+
+	for (i = 0; i < n; i++) {
+		yr[i] = x[i];
+		yi[i] = 0;
+	}
+
+	for (i = 1, j = 0; i < n; i++) {
+		for (k = n >> 1; j & k; k >>= 1)
+			j ^= k;
+		j |= k;
+		if (i < j) {
+			tr = yr[i];
+			yr[i] = yr[j];
+			yr[j] = tr;
+		}
+	}
+
+	for (l = 1; l < n; l <<= 1) {
+		for (k = 0; k < l; k++) {
+			cr = cos(M_PI * k / l);
+			ci = -sin(M_PI * k / l);
+			for (i = k; i < n; i += 2 * l) {
+				tr = cr * yr[i + l] - ci * yi[i + l];
+				ti = cr * yi[i + l] + ci * yr[i + l];
+				yr[i + l] = yr[i] - tr;
+				yi[i + l] = yi[i] - ti;
+				yr[i] += tr;
+				yi[i] += ti;
+			}
+		}
+	}
+}
+
+static void reference(double *yr, double *yi, const double *x, int n)
+{
+	if (n <= BENCH_DFT_MAX || (n & (n - 1)))
+		ref_dft(yr, yi, x, n);
+	else
+		ref_fft(yr, yi, x, n);
+}
+
+struct error {
+	double sig, err, max;
+};
+
+static void error_add(struct error *e, double ref, double val)
+{
+	double d = fabs(val - ref);
+
+	e->sig += ref * ref;
+	e->err += d * d;
+	e->max = d > e->max ? d : e->max;
+}
+
+static void report(const char *kernel, int n, int type, double t,
+		   const struct error *e, int snr)
+{
+	printf("%s,%d,%s,%.3f,%.2f,", kernel, n, input_name[type],
+	       t * 1e6, n / t * 1e-6);
+	if (snr)
+		printf("%.2f", e->err > 0 ? 10 * log10(e->sig / e->err) : 999.0);
+	printf(",%.4g\n", e->max);
+}
+
+/*
+ * Seconds per call of kernel on a fresh copy of the input; the time of
+ * the copy alone is measured the same way and subtracted. The kernel
+ * runs once more at the end, to leave its result in dst.
+ */
+#define TIME_KERNEL(t, dst, src, bytes, kernel)				\
+	do {								\
+		double _t0, _t1, _tc;					\
+		long _i, _reps = 1;					\
+		for (;;) {						\
+			_t0 = now();					\
+			for (_i = 0; _i < _reps; _i++) {		\
+				memcpy(dst, src, bytes);		\
+				kernel;					\
+			}						\
+			_t1 = now() - _t0;				\
+			if (_t1 >= BENCH_MIN_TIME)			\
+				break;					\
+			_reps *= 2;					\
+		}							\
+		_t0 = now();						\
+		for (_i = 0; _i < _reps; _i++) {			\
+			memcpy(dst, src, bytes);			\
+			__asm__ __volatile__("" : : "r"(dst) : "memory"); \
+		}							\
+		_tc = now() - _t0;					\
+		t = (_t1 - (_tc < _t1 ? _tc : 0)) / _reps;		\
+		memcpy(dst, src, bytes);				\
+		kernel;							\
+	} while (0)
+
+static void bench_fix(int m, int type)
+{
+	int n = 1 << m, i;
+	double *x = malloc(3 * n * sizeof(double)), *yr = x + n, *yi = yr + n;
+	fixed *in = malloc(6 * n * sizeof(fixed)), *fr = in + 2 * n;
+	fixed *loud = fr + 2 * n, *fi = fr + n;
+	float *db = malloc(n * sizeof(float));
+	struct error e;
+	double t, w, ref;
+
+	make_input(x, n, type);
+	reference(yr, yi, x, n);
+
+	/* fix_fft(), forward, scaled by 1/n */
+	for (i = 0; i < n; i++) {
+		in[i] = x[i];
+		in[n + i] = 0;
+	}
+	TIME_KERNEL(t, fr, in, 2 * n * sizeof(fixed), fix_fft(fr, fi, m, 0));
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n; i++) {
+		error_add(&e, yr[i] / n, fr[i]);
+		error_add(&e, yi[i] / n, fi[i]);
+	}
+	report("fix_fft", n, type, t, &e, 1);
+
+	/* fix_loud() and fix_loud_db(), on that spectrum */
+	memcpy(in, fr, 2 * n * sizeof(fixed));
+	TIME_KERNEL(t, fr, in, 2 * n * sizeof(fixed),
+		    fix_loud(loud, fr, fi, n / 2, 0));
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n / 2; i++) {
+		ref = 10 * log10((double)fr[i] * fr[i] + (double)fi[i] * fi[i] +
+				 1e-30) + fix_loud_offset(0);
+		/* the table ends at -99 dB, levels clamp at 0 dB */
+		if (ref > -90 && ref < 0)
+			error_add(&e, ref, loud[i]);
+	}
+	report("fix_loud", n, type, t, &e, 0);
+
+	TIME_KERNEL(t, fr, in, 2 * n * sizeof(fixed),
+		    fix_loud_db(db, fr, fi, n / 2, 0));
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n / 2; i++) {
+		if (fr[i] == 0 && fi[i] == 0)
+			continue;
+		ref = 10 * log10((double)fr[i] * fr[i] +
+				 (double)fi[i] * fi[i]) + fix_loud_offset(0);
+		error_add(&e, ref, db[i]);
+	}
+	report("fix_loud_db", n, type, t, &e, 0);
+
+	/* window(), its second half mirrors the first one */
+	for (i = 0; i < n; i++)
+		in[i] = x[i];
+	TIME_KERNEL(t, fr, in, n * sizeof(fixed), window(fr, n));
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n; i++) {
+		w = 0.5 - 0.5 * cos(2 * M_PI * (i < n / 2 ? i : n - 1 - i) / n);
+		error_add(&e, x[i] * w, fr[i]);
+	}
+	report("window", n, type, t, &e, 1);
+
+	free(db);
+	free(in);
+	free(x);
+}
+
+static void bench_fix32(int m, int type)
+{
+	int n = 1 << m, i, e32;
+	double *x = malloc(3 * n * sizeof(double)), *yr = x + n, *yi = yr + n;
+	int32_t *in = malloc(4 * n * sizeof(int32_t)), *fr = in + 2 * n;
+	int32_t *fi = fr + n;
+	struct error e;
+	double t, w, scale;
+
+	make_input(x, n, type);
+	reference(yr, yi, x, n);
+
+	/* fix_fft32(), Q15 input << 16, compared at 1/n like fix_fft() */
+	for (i = 0; i < n; i++) {
+		in[i] = x[i] * 65536;
+		in[n + i] = 0;
+	}
+	TIME_KERNEL(t, fr, in, 2 * n * sizeof(int32_t),
+		    e32 = fix_fft32(fr, fi, m, 0));
+	scale = ldexp(1, e32 - 16 - m);
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n; i++) {
+		error_add(&e, yr[i] / n, fr[i] * scale);
+		error_add(&e, yi[i] / n, fi[i] * scale);
+	}
+	report("fix_fft32", n, type, t, &e, 1);
+
+	/* window32(), shaped like window() */
+	TIME_KERNEL(t, fr, in, n * sizeof(int32_t), window32(fr, n));
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n; i++) {
+		w = 0.5 - 0.5 * cos(2 * M_PI * (i < n / 2 ? i : n - 1 - i) / n);
+		error_add(&e, x[i] * w, fr[i] / 65536.0);
+	}
+	report("window32", n, type, t, &e, 1);
+
+	free(in);
+	free(x);
+}
+
+static void bench_float(int n, int type)
+{
+	int i;
+	double *x = malloc(3 * n * sizeof(double)), *yr = x + n, *yi = yr + n;
+	float *in = malloc(4 * n * sizeof(float)), *fr = in + 2 * n;
+	float *fi = fr + n;
+	struct error e;
+	double t, w;
+
+	make_input(x, n, type);
+	reference(yr, yi, x, n);
+
+	/* cfft(), unscaled; compared at 1/n like fix_fft() */
+	for (i = 0; i < n; i++) {
+		in[i] = x[i];
+		in[n + i] = 0;
+	}
+	TIME_KERNEL(t, fr, in, 2 * n * sizeof(float), cfft(fr, fi, n, 0));
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n; i++) {
+		error_add(&e, yr[i] / n, fr[i] / n);
+		error_add(&e, yi[i] / n, fi[i] / n);
+	}
+	report("cfft", n, type, t, &e, 1);
+
+	/* fwindow(), periodic */
+	TIME_KERNEL(t, fr, in, n * sizeof(float), fwindow(fr, n));
+	memset(&e, 0, sizeof(e));
+	for (i = 0; i < n; i++) {
+		w = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+		error_add(&e, x[i] * w, fr[i]);
+	}
+	report("fwindow", n, type, t, &e, 1);
+
+	free(in);
+	free(x);
+}
+
+int main(int argc, char **argv)
+{
+	int max = argc > 1 ? atoi(argv[1]) : 16, m, type;
+
+	if (max < 4 || max > 24) {
+		fprintf(stderr, "usage: %s [log2 size, 4..24]\n", argv[0]);
+		return 1;
+	}
+
+	printf("kernel,n,input,us_per_call,msamples_per_s,snr_db,max_err\n");
+
+	for (m = 4; m <= max; m++) {
+		for (type = 0; type < INPUT_NUM; type++) {
+			if (m <= FIX_FFT_MAX)
+				bench_fix(m, type);
+			if (m <= LOG2_N_WAVE32)
+				bench_fix32(m, type);
+			bench_float(1 << m, type);
+		}
+		fflush(stdout);
+	}
+
+	/* mixed radix and, for the prime, Bluestein */
+	for (m = 0; m < sizeof(odd_size) / sizeof(odd_size[0]); m++) {
+		if (odd_size[m] > 1 << max)
+			break;
+		for (type = 0; type < INPUT_NUM; type++)
+			bench_float(odd_size[m], type);
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,413 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Cross spectrum, magnitude squared coherence and phase between two
+ * channels of a board, and between the master (LPC) and slave (HPC)
+ * boards. Welch averaged over half overlapping segments.
+ *
+ * Every source channel is transformed once per segment, whatever the
+ * number of pairs it is part of. Two real channels share one complex
+ * FFT and are separated afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define CROSS_SOURCES	3	/* LPC ch0, LPC ch1, HPC ch */
+
+struct cross_source {
+	const short *data;
+	unsigned stride;
+};
+
+/* add source channel c of a capture; returns its index */
+static int cross_add_source(struct cross_source *src, int *nsrc,
+			    const s_capture * cap, unsigned c)
+{
+	src[*nsrc].data = cap->data + (c < cap->samples_per_scan ? c : 0);
+	src[*nsrc].stride = cap->samples_per_scan;
+
+	return (*nsrc)++;
+}
+
+static void cross_load(float *x, const struct cross_source *src,
+		       unsigned first, unsigned n)
+{
+	const short *d = src->data + first * src->stride;
+	unsigned i;
+
+	for (i = 0; i < n; i++)
+		x[i] = d[i * src->stride];
+}
+
+/*
+ * Z = FFT(a + jb) of two real signals:
+ * A[k] = (Z[k] + Z*[N-k]) / 2, B[k] = (Z[k] - Z*[N-k]) / 2j
+ */
+static void cross_split(float *ar, float *ai, float *br, float *bi,
+			const float *zr, const float *zi, unsigned n)
+{
+	unsigned k, m;
+
+	for (k = 0; k <= n / 2; k++) {
+		m = k ? n - k : 0;
+		ar[k] = 0.5f * (zr[k] + zr[m]);
+		ai[k] = 0.5f * (zi[k] - zi[m]);
+		br[k] = 0.5f * (zi[k] + zi[m]);
+		bi[k] = 0.5f * (zr[m] - zr[k]);
+	}
+}
+
+static float cross_coherence(float mag, float saa, float sbb)
+{
+	if (saa <= 0 || sbb <= 0)
+		return 0;
+
+	return (mag / saa) * (mag / sbb);
+}
+
+/* power ratio of b to a in dB */
+static float cross_gain(float saa, float sbb)
+{
+	if (saa <= 0 || sbb <= 0)
+		return 0;
+
+	return 10 * log10f(sbb / saa);
+}
+
+/**
+ * cross_sample() - cross spectra of the retained captures
+ * @info:	settings and the captures in scapture[]; the results
+ *		shown on the page go to scross
+ * @out:	file the plot data goes to, one line per bin:
+ *		"Hz" then "dB coherence phase gain" for each pair, or
+ *		NULL for the results only
+ *
+ * Pairs are LPC ch0 to ch1 when both channels were captured, and the
+ * first enabled channel of LPC to the same channel of HPC when there
+ * is a slave. Phase is that of the second channel relative to the
+ * first, gain is the ratio of their power spectra. Segments of
+ * 1 << fsamples points, at most those of LOG2_N_WAVE32 as
+ * check_request() bounds it, overlap by half; fsamples 0 makes the
+ * whole capture one segment.
+ *
+ * Returns the number of pairs, or a negative errno.
+ **/
+int cross_sample(s_info * info, FILE * out)
+{
+	s_capture *lpc = &info->scapture[0], *hpc = &info->scapture[1];
+	struct cross_source src[CROSS_SOURCES];
+	int pa[2], pb[2], npairs = 0, nsrc = 0;
+	unsigned n = lpc->samples, nfft;
+	unsigned bins, hop, segments, slots, seg, s, p, k, peak;
+	float *buf, *zr, *zi, *xr, *xi, *sxx, *sr, *si, *db;
+	float offset = fix_loud_offset(2), scale;
+	double f;
+	s_text text;
+
+	if (lpc->data == NULL)
+		return -EINVAL;
+
+	if (lpc->samples_per_scan > 1) {
+		pa[npairs] = cross_add_source(src, &nsrc, lpc, 0);
+		pb[npairs] = cross_add_source(src, &nsrc, lpc, 1);
+		snprintf(info->scross.pair[npairs].name, 16, "CH0 x CH1");
+		npairs++;
+	}
+
+	if (info->has_slave && hpc->data) {
+		unsigned c = (info->channel_en_mask & 1) ? 0 : 1;
+
+		/* LPC ch0 and ch1 are sources 0 and 1 if already added */
+		pa[npairs] = nsrc ? c : cross_add_source(src, &nsrc, lpc, c);
+		pb[npairs] = cross_add_source(src, &nsrc, hpc, c);
+		snprintf(info->scross.pair[npairs].name, 16, "LPC x HPC");
+		if (n > hpc->samples)
+			n = hpc->samples;
+		npairs++;
+	}
+
+	if (npairs == 0)
+		return -EINVAL;
+
+	/* a depth FFT makes the whole capture one segment */
+	nfft = info->stime_s.fsamples ? 1 << info->stime_s.fsamples : n;
+	while (nfft > n && nfft > 2)
+		nfft >>= 1;
+	bins = nfft / 2 + 1;
+	hop = nfft / 2;
+	segments = (n - nfft) / hop + 1;
+	/* sources are transformed in pairs, an odd one gets a spare slot */
+	slots = (nsrc + 1) & ~1;
+
+	/*
+	 * zr, zi: FFT input and output; xr, xi: spectra of each source;
+	 * sxx: averaged auto spectra; sr, si: averaged cross spectra;
+	 * db: cross spectra in dB
+	 */
+	buf = calloc(2 * nfft + (2 * slots + nsrc + 3 * npairs) * bins,
+		     sizeof(float));
+	if (buf == NULL)
+		return -ENOMEM;
+	zr = buf;
+	zi = zr + nfft;
+	xr = zi + nfft;
+	xi = xr + slots * bins;
+	sxx = xi + slots * bins;
+	sr = sxx + nsrc * bins;
+	si = sr + npairs * bins;
+	db = si + npairs * bins;
+
+	for (seg = 0; seg < segments; seg++) {
+		for (s = 0; s < nsrc; s += 2) {
+			cross_load(zr, &src[s], seg * hop, nfft);
+			if (s + 1 < nsrc)
+				cross_load(zi, &src[s + 1], seg * hop, nfft);
+			else
+				memset(zi, 0, nfft * sizeof(float));
+
+			if (info->sdisplay.window) {
+				fwindow(zr, nfft);
+				fwindow(zi, nfft);
+			}
+
+			cfft(zr, zi, nfft, 0);
+
+			/* with an odd source, B = 0 lands in the spare slot */
+			cross_split(xr + s * bins, xi + s * bins,
+				    xr + (s + 1) * bins, xi + (s + 1) * bins,
+				    zr, zi, nfft);
+		}
+
+		for (s = 0; s < nsrc; s++) {
+			float *ar = xr + s * bins, *ai = xi + s * bins;
+			float *a = sxx + s * bins;
+
+			for (k = 0; k < bins; k++)
+				a[k] += ar[k] * ar[k] + ai[k] * ai[k];
+		}
+
+		/* S_ab = conj(A) B */
+		for (p = 0; p < npairs; p++) {
+			float *ar = xr + pa[p] * bins, *ai = xi + pa[p] * bins;
+			float *br = xr + pb[p] * bins, *bi = xi + pb[p] * bins;
+			float *cr = sr + p * bins, *ci = si + p * bins;
+
+			for (k = 0; k < bins; k++) {
+				cr[k] += ar[k] * br[k] + ai[k] * bi[k];
+				ci[k] += ar[k] * bi[k] - ai[k] * br[k];
+			}
+		}
+	}
+
+	/* same scaling as the Q15 path, fix_fft() divides by N */
+	scale = 1.0f / ((float)nfft * nfft * segments);
+
+	/*
+	 * |S_ab| is used instead of its square, which overflows a float
+	 * for long FFTs; coherence is |S_ab|^2 / (S_aa S_bb)
+	 */
+	for (p = 0; p < npairs; p++) {
+		float *a = sxx + pa[p] * bins, *b = sxx + pb[p] * bins;
+		float *cr = sr + p * bins, *ci = si + p * bins;
+		float *mag = zr;	/* the FFT buffer is free now */
+		cross_pair *cp = &info->scross.pair[p];
+
+		for (k = 0; k < bins; k++)
+			mag[k] = hypotf(cr[k], ci[k]);
+
+		/* the strongest common tone, DC excluded */
+		for (k = 2, peak = 1; k < bins - 1; k++)
+			if (mag[k] > mag[peak])
+				peak = k;
+
+		cp->freq = (double)peak * info->stime_s.sps / nfft;
+		cp->coherence = cross_coherence(mag[peak], a[peak], b[peak]);
+		cp->phase = atan2f(ci[peak], cr[peak]) * (180 / M_PI);
+		cp->gain = cross_gain(a[peak], b[peak]);
+
+		for (k = 0; k < bins; k++)
+			mag[k] *= scale;
+		power_db(db + p * bins, mag, bins, offset);
+	}
+
+	text_open(&text, out);
+	for (k = info->sdisplay.fftexludezero; k < nfft / 2; k++) {
+		f = (double)k * info->stime_s.sps / nfft;
+		text_fixed(&text, f, 6, 0);
+		for (p = 0; p < npairs; p++) {
+			float *a = sxx + pa[p] * bins, *b = sxx + pb[p] * bins;
+			float cr = sr[p * bins + k], ci = si[p * bins + k];
+
+			text_char(&text, ' ');
+			text_fixed(&text, db[p * bins + k], 2, ' ');
+			text_fixed(&text, cross_coherence(hypotf(cr, ci), a[k], b[k]),
+				   4, ' ');
+			text_fixed(&text, atan2f(ci, cr) * (180 / M_PI), 2, ' ');
+			text_fixed(&text, cross_gain(a[k], b[k]), 2, 0);
+		}
+		text_char(&text, '\n');
+	}
+	text_close(&text);
+
+	info->scross.nfft = nfft;
+	info->scross.segments = segments;
+	info->scross.npairs = npairs;
+
+	free(buf);
+
+	return npairs;
+}
+
+/**
+ * capture_results() - cross spectra and delay of the retained captures
+ * @info:	settings and the captures in scapture[]
+ * @out:	file for the cross spectra plot data, or NULL for none
+ *
+ * Runs once the captures of all boards are in, after iio_sample().
+ *
+ * Returns 0, or a negative errno if the selected cross spectrum can't
+ * be had from the captured channels.
+ **/
+int capture_results(s_info * info, FILE * out)
+{
+	int ret;
+
+	if (info->sdisplay.cross && !info->sdisplay.tdom && info->run != TONE) {
+		ret = cross_sample(info, out);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* the HW FFT leaves no samples to correlate */
+	if (info->sdisplay.corr && info->run != TONE &&
+	    !(info->sdisplay.hw_fft && !info->sdisplay.tdom))
+		corr_delay(info);
+
+	return 0;
+}
+
+/**
+ * corr_delay() - delay between two channels by FFT cross correlation
+ * @info:	settings and the captures in scapture[]; the result goes
+ *		to scorr
+ *
+ * Correlates the first enabled channel of LPC and HPC, or CH0 and CH1
+ * of LPC without a slave. Both are zero padded to twice their length,
+ * so the correlation is linear, not circular; the two real channels
+ * share one complex FFT. The delay is positive when the second
+ * channel lags the first, with the fraction from a parabola through
+ * the correlation peak and its neighbours. The quality is the
+ * normalized correlation coefficient at the peak.
+ *
+ * Returns 0 on success or a negative errno.
+ **/
+int corr_delay(s_info * info)
+{
+	s_capture *lpc = &info->scapture[0], *hpc = &info->scapture[1];
+	struct cross_source src[2];
+	unsigned n = lpc->samples, len, i, k, m, c = 0;
+	float *zr, *zi, ar, ai, br, bi, pr, pi, d;
+	double ma = 0, mb = 0, ea = 0, eb = 0;
+	int nsrc = 0, lag, best;
+
+	info->scorr.valid = 0;
+
+	if (lpc->data == NULL)
+		return -EINVAL;
+
+	if (info->has_slave && hpc->data) {
+		c = (info->channel_en_mask & 1) ? 0 : 1;
+		cross_add_source(src, &nsrc, lpc, c);
+		cross_add_source(src, &nsrc, hpc, c);
+		if (n > hpc->samples)
+			n = hpc->samples;
+	} else if (lpc->samples_per_scan > 1) {
+		cross_add_source(src, &nsrc, lpc, 0);
+		cross_add_source(src, &nsrc, lpc, 1);
+	} else {
+		return -EINVAL;
+	}
+
+	for (len = 2; len < 2 * n; len <<= 1) ;
+
+	zr = calloc(2 * len, sizeof(float));
+	if (zr == NULL)
+		return -ENOMEM;
+	zi = zr + len;
+
+	cross_load(zr, &src[0], 0, n);
+	cross_load(zi, &src[1], 0, n);
+
+	/* without the DC, offsets would correlate too */
+	for (i = 0; i < n; i++) {
+		ma += zr[i];
+		mb += zi[i];
+	}
+	ma /= n;
+	mb /= n;
+	for (i = 0; i < n; i++) {
+		zr[i] -= ma;
+		zi[i] -= mb;
+		ea += (double)zr[i] * zr[i];
+		eb += (double)zi[i] * zi[i];
+	}
+
+	cfft(zr, zi, len, 0);
+
+	/*
+	 * Split into A and B as in cross_split(), then conj(A) B. The
+	 * correlation is real, so bin len - k is the conjugate of bin k;
+	 * both are written in place from the pair they are computed from.
+	 */
+	for (k = 0; k <= len / 2; k++) {
+		m = (len - k) & (len - 1);
+		ar = 0.5f * (zr[k] + zr[m]);
+		ai = 0.5f * (zi[k] - zi[m]);
+		br = 0.5f * (zi[k] + zi[m]);
+		bi = 0.5f * (zr[m] - zr[k]);
+		pr = ar * br + ai * bi;
+		pi = ar * bi - ai * br;
+		zr[k] = pr;
+		zi[k] = pi;
+		zr[m] = pr;
+		zi[m] = -pi;
+	}
+
+	cfft(zr, zi, len, 1);
+
+	/* lags 0 .. n - 1 at the start, -(n - 1) .. -1 at the end */
+	best = 0;
+	for (lag = -(int)n + 1; lag < (int)n; lag++)
+		if (fabsf(zr[lag & (len - 1)]) > fabsf(zr[best & (len - 1)]))
+			best = lag;
+
+	d = 0;
+	if (best > -(int)n + 1 && best < (int)n - 1) {
+		float ym = zr[(best - 1) & (len - 1)];
+		float y0 = zr[best & (len - 1)];
+		float yp = zr[(best + 1) & (len - 1)];
+
+		if (ym - 2 * y0 + yp != 0)
+			d = 0.5f * (ym - yp) / (ym - 2 * y0 + yp);
+	}
+
+	info->scorr.lag = best;
+	info->scorr.delay = best + d;
+	info->scorr.quality = (ea > 0 && eb > 0) ?
+		zr[best & (len - 1)] / (len * sqrt(ea * eb)) : 0;
+	info->scorr.valid = 1;
+
+	free(zr);
+
+	return 0;
+}
@@ -0,0 +1,513 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Capture data for drawing in the browser ("BD" request key, with the
+ * usual form fields): the decoded channels and the spectra of the last
+ * acquisition as typed arrays, behind a small JSON header describing
+ * them, so no image is rendered on the board. Little endian:
+ *
+ *   0      u32   JSON header length L, a multiple of 4 (space padded)
+ *   4      JSON  header, see below
+ *   4 + L        arrays, each at a multiple of 4
+ *
+ * The header has the capture settings, one entry per array with its
+ * name, type ("int16" or "float32"), byte offset from the end of the
+ * header, length and x axis (x of value i is x0 + i * dx), and the
+ * statistics, markers, metrics, cross spectra and delay of the capture.
+ * Channels are ADC codes, scale and offset convert them to full scale;
+ * spectra are in dB with NaN gaps, values the JSON can't hold are null.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define DATA_JSON	8192
+#define DATA_ARRAYS	(4 + 4)		/* channels of two boards, spectra */
+#define DATA_BUF	65536		/* bytes per fwrite() */
+
+struct data_array {
+	char name[24];
+	const short *s;		/* samples, stride apart, or */
+	const float *f;		/* values */
+	unsigned stride;
+	unsigned n;
+	double x0;
+	double dx;
+};
+
+struct json {
+	char *buf;
+	unsigned size;
+	unsigned len;
+	int err;
+};
+
+static void json_printf(struct json *j, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (j->err)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(j->buf + j->len, j->size - j->len, fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || len >= (int)(j->size - j->len))
+		j->err = -ENOSPC;
+	else
+		j->len += len;
+}
+
+/* JSON has no NaN or infinities */
+static void json_num(struct json *j, const char *name, double v)
+{
+	if (isfinite(v))
+		json_printf(j, "\"%s\":%.7g,", name, v);
+	else
+		json_printf(j, "\"%s\":null,", name);
+}
+
+/* the trailing comma of the last member */
+static void json_close(struct json *j, char c)
+{
+	if (!j->err && j->len && j->buf[j->len - 1] == ',')
+		j->len--;
+	json_printf(j, "%c,", c);
+}
+
+static unsigned data_bytes(const struct data_array *a)
+{
+	return ((a->s ? 2 : 4) * a->n + 3) & ~3;
+}
+
+/* as plot_time() and plot_spectrum() name and place them */
+static unsigned data_arrays(s_info * info, struct data_array *a)
+{
+	s_capture *cap;
+	s_spectrum *sp;
+	double shift = 0, df = 1;
+	unsigned b, c, h, n = 0, nb = info->has_slave ? 2 : 1;
+
+	if (info->sdisplay.align && info->scorr.valid)
+		shift = -info->scorr.delay;
+
+	for (b = 0; b < nb; b++) {
+		cap = &info->scapture[b];
+		if (cap->data == NULL)
+			continue;
+		for (c = 0; c < 2; c++) {
+			if (!(info->channel_en_mask & (1 << c)))
+				continue;
+			a[n].s = cap->data + (c < cap->samples_per_scan ? c : 0);
+			a[n].stride = cap->samples_per_scan;
+			a[n].n = cap->samples;
+			a[n].dx = 1;
+			if (info->has_slave) {
+				a[n].x0 = b ? shift : 0;
+				snprintf(a[n].name, sizeof(a[n].name), "%s_CH%u",
+					 b ? "HPC" : "LPC", c);
+			} else {
+				a[n].x0 = (c && info->channel_en_mask == 3) ? shift : 0;
+				snprintf(a[n].name, sizeof(a[n].name), "ch%u", c);
+			}
+			n++;
+		}
+	}
+
+	/* only there if the display was the software FFT */
+	if (info->sdisplay.fftscaled)
+		df = (double)info->stime_s.sps / info->stime_s.samples;
+	for (h = 0; h < 2; h++)
+		for (b = 0; b < nb; b++) {
+			sp = &info->sspectrum[b];
+			if (sp->db == NULL || (h && sp->hold == NULL))
+				continue;
+			a[n].f = h ? sp->hold : sp->db;
+			a[n].n = sp->n;
+			a[n].x0 = sp->k0 * df;
+			a[n].dx = df;
+			snprintf(a[n].name, sizeof(a[n].name), "%s%s",
+				 info->has_slave ? (b ? "HPC " : "LPC ") : "",
+				 h ? trace_name(info) : "FFT");
+			n++;
+		}
+
+	return n;
+}
+
+static void data_stats(struct json *j, const struct data_array *a)
+{
+	double sum = 0, sq = 0, v;
+	int lo, hi;
+	unsigned i;
+
+	if (a->n == 0)
+		return;
+
+	lo = hi = a->s[0];
+	for (i = 0; i < a->n; i++) {
+		v = a->s[i * a->stride];
+		lo = v < lo ? v : lo;
+		hi = v > hi ? v : hi;
+		sum += v;
+		sq += v * v;
+	}
+
+	json_printf(j, "\"min\":%d,\"max\":%d,", lo, hi);
+	json_num(j, "mean", sum / a->n);
+	json_num(j, "rms", sqrt(sq / a->n));
+}
+
+static void data_markers(struct json *j, s_info * info, unsigned b)
+{
+	s_markers *mk = &info->smarkers[b];
+	s_metrics *m = &info->smetrics[b];
+	s_iq *iq = &info->siq[b];
+	unsigned i;
+
+	json_printf(j, "{\"board\":\"%s\",\"markers\":[", b ? "HPC" : "LPC");
+	for (i = 0; i < mk->n; i++) {
+		json_printf(j, "{");
+		json_num(j, "freq", mk->peak[i].freq);
+		json_num(j, "db", mk->peak[i].db);
+		json_close(j, '}');
+	}
+	json_close(j, ']');
+
+	json_printf(j, "\"harmonics\":[");
+	for (i = 0; i < mk->nharm; i++) {
+		json_printf(j, "{");
+		json_num(j, "freq", mk->harm[i].freq);
+		json_num(j, "dbc", mk->harm[i].db);
+		json_close(j, '}');
+	}
+	json_close(j, ']');
+
+	if (m->valid) {
+		json_printf(j, "\"metrics\":{");
+		json_num(j, "fund_freq", (double)m->fund_bin *
+			 info->stime_s.sps / info->stime_s.samples);
+		json_num(j, "fund_dbfs", m->fund_dbfs);
+		json_num(j, "snr", m->snr);
+		json_num(j, "sinad", m->sinad);
+		json_num(j, "sfdr", m->sfdr);
+		json_num(j, "thd", m->thd);
+		json_num(j, "enob", m->enob);
+		json_num(j, "snr_fs", m->snr_fs);
+		json_num(j, "sinad_fs", m->sinad_fs);
+		json_num(j, "sfdr_fs", m->sfdr_fs);
+		json_num(j, "thd_fs", m->thd_fs);
+		json_num(j, "enob_fs", m->enob_fs);
+		json_close(j, '}');
+	}
+
+	if (iq->valid) {
+		json_printf(j, "\"iq\":{");
+		json_num(j, "freq", (double)iq->bin *
+			 info->stime_s.sps / info->stime_s.samples);
+		json_num(j, "irr", iq->irr);
+		json_num(j, "gain", iq->gain);
+		json_num(j, "phase", iq->phase);
+		json_close(j, '}');
+	}
+
+	json_close(j, '}');
+}
+
+/* per board markers, metrics and I/Q readout, cross spectra, the delay */
+static void data_results(struct json *j, s_info * info)
+{
+	const cross_pair *cp;
+	unsigned b;
+
+	json_printf(j, "\"boards\":[");
+	for (b = 0; b < (info->has_slave ? 2 : 1); b++)
+		data_markers(j, info, b);
+	json_close(j, ']');
+
+	if (info->sdisplay.cross && info->scross.npairs) {
+		json_printf(j, "\"cross\":[");
+		for (b = 0; b < info->scross.npairs; b++) {
+			cp = &info->scross.pair[b];
+			json_printf(j, "{\"name\":\"%s\",", cp->name);
+			json_num(j, "freq", cp->freq);
+			json_num(j, "coherence", cp->coherence);
+			json_num(j, "phase", cp->phase);
+			json_num(j, "gain", cp->gain);
+			json_close(j, '}');
+		}
+		json_close(j, ']');
+	}
+
+	if (info->scorr.valid) {
+		json_printf(j, "\"delay\":{");
+		json_num(j, "samples", info->scorr.delay);
+		json_num(j, "corr", info->scorr.quality);
+		json_close(j, '}');
+	}
+}
+
+static int data_header(struct json *j, s_info * info,
+		       const struct data_array *a, unsigned n, const char *extra)
+{
+	unsigned k, offset = 0;
+
+	json_printf(j, "{%s\"version\":1,\"sps\":%u,\"samples\":%u,\"mask\":%u,",
+		    extra ? extra : "", info->stime_s.sps,
+		    info->stime_s.samples, info->channel_en_mask & 3);
+	json_num(j, "scale", 1 / ADC_FULL_SCALE);
+	json_printf(j, "\"offset\":%d,\"arrays\":[", BINARY_OFFSET);
+
+	for (k = 0; k < n; k++) {
+		json_printf(j, "{\"name\":\"%s\",\"type\":\"%s\",\"offset\":%u,\"length\":%u,",
+			    a[k].name, a[k].s ? "int16" : "float32",
+			    offset, a[k].n);
+		json_num(j, "x0", a[k].x0);
+		json_num(j, "dx", a[k].dx);
+		if (a[k].s)
+			data_stats(j, &a[k]);
+		json_close(j, '}');
+		offset += data_bytes(&a[k]);
+	}
+	json_close(j, ']');
+
+	data_results(j, info);
+	json_close(j, '}');
+
+	/* the close's comma, then pad for the arrays */
+	if (!j->err)
+		j->len--;
+	while (!j->err && j->len % 4)
+		json_printf(j, " ");
+
+	return j->err;
+}
+
+static int data_array_write(FILE * out, const struct data_array *a,
+			    unsigned char *buf)
+{
+	union {
+		float f;
+		uint32_t u;
+	} v;
+	unsigned i, len = 0, bytes = data_bytes(a);
+	int total = 0;
+
+	for (i = 0; i < a->n; i++) {
+		if (a->s) {
+			put_le16(buf + len, a->s[i * a->stride]);
+			len += 2;
+		} else {
+			v.f = a->f[i];
+			put_le32(buf + len, v.u);
+			len += 4;
+		}
+		if (len > DATA_BUF - 4) {
+			total += fwrite(buf, 1, len, out);
+			len = 0;
+		}
+	}
+	/* to the next array */
+	while ((total + len) < bytes)
+		buf[len++] = 0;
+
+	return total + fwrite(buf, 1, len, out);
+}
+
+/**
+ * data_measure() - the measurements of a capture as JSON
+ * @info:	settings, scapture[] and the results of iio_sample()
+ * @extra:	JSON members to add, each with a trailing comma, or NULL
+ * @buf:	output, reused from capture to capture
+ * @size:	its size
+ *
+ * The statistics of each channel and the markers, metrics, I/Q readout
+ * and delay, as in the data_send() header, without the arrays.
+ *
+ * Returns the length, without a terminating NUL, or a negative errno.
+ **/
+int data_measure(s_info * info, const char *extra, char *buf, unsigned size)
+{
+	struct data_array a[DATA_ARRAYS];
+	struct json j;
+	unsigned n, k;
+
+	memset(a, 0, sizeof(a));
+	n = data_arrays(info, a);
+
+	memset(&j, 0, sizeof(j));
+	j.buf = buf;
+	j.size = size;
+
+	json_printf(&j, "{%s\"sps\":%u,\"samples\":%u,\"channels\":[",
+		    extra ? extra : "", info->stime_s.sps,
+		    info->stime_s.samples);
+	for (k = 0; k < n && a[k].s; k++) {
+		json_printf(&j, "{\"name\":\"%s\",", a[k].name);
+		data_stats(&j, &a[k]);
+		json_close(&j, '}');
+	}
+	json_close(&j, ']');
+
+	data_results(&j, info);
+	json_close(&j, '}');
+
+	/* the close's comma */
+	if (j.err)
+		return j.err;
+	buf[--j.len] = 0;
+
+	return j.len;
+}
+
+static void data_array_put(unsigned char *dst, const struct data_array *a)
+{
+	union {
+		float f;
+		uint32_t u;
+	} v;
+	unsigned i;
+
+	if (a->s) {
+		for (i = 0; i < a->n; i++)
+			put_le16(dst + 2 * i, a->s[i * a->stride]);
+		memset(dst + 2 * a->n, 0, data_bytes(a) - 2 * a->n);
+	} else {
+		for (i = 0; i < a->n; i++) {
+			v.f = a->f[i];
+			put_le32(dst + 4 * i, v.u);
+		}
+	}
+}
+
+/**
+ * data_frame() - a plot's traces as a frame of the live stream
+ * @info:	settings, for the header
+ * @p:		traces, from plot_traces() and maybe plot_reduce()
+ * @extra:	JSON members to add, each with a trailing comma, or NULL
+ * @buf:	frame buffer, grown as needed, free() it when done
+ * @size:	its size
+ *
+ * The frame length, u32, then the layout of data_send() without the
+ * CGI headers.
+ *
+ * Returns the length of the frame, with its length, or a negative errno.
+ **/
+int data_frame(s_info * info, const s_plot * p, const char *extra,
+	       unsigned char **buf, unsigned *size)
+{
+	struct data_array a[PLOT_TRACES];
+	struct json j;
+	unsigned char *dst;
+	unsigned k, length;
+
+	memset(a, 0, sizeof(a));
+	for (k = 0; k < p->ntraces; k++) {
+		strcpy(a[k].name, p->trace[k].title);
+		a[k].s = p->trace[k].s;
+		a[k].f = p->trace[k].f;
+		a[k].stride = p->trace[k].stride;
+		a[k].n = p->trace[k].n;
+		a[k].x0 = p->trace[k].x0;
+		a[k].dx = p->trace[k].dx;
+	}
+
+	if (*size < 8 + DATA_JSON) {
+		dst = realloc(*buf, 8 + DATA_JSON);
+		if (dst == NULL)
+			return -ENOMEM;
+		*buf = dst;
+		*size = 8 + DATA_JSON;
+	}
+
+	memset(&j, 0, sizeof(j));
+	j.buf = (char *)*buf + 8;
+	j.size = DATA_JSON;
+	if (data_header(&j, info, a, p->ntraces, extra) < 0)
+		return j.err;
+
+	length = 8 + j.len;
+	for (k = 0; k < p->ntraces; k++)
+		length += data_bytes(&a[k]);
+	if (length > *size) {
+		dst = realloc(*buf, length);
+		if (dst == NULL)
+			return -ENOMEM;
+		*buf = dst;
+		*size = length;
+	}
+
+	put_le32(*buf, length - 4);
+	put_le32(*buf + 4, j.len);
+	dst = *buf + 8 + j.len;
+	for (k = 0; k < p->ntraces; k++) {
+		data_array_put(dst, &a[k]);
+		dst += data_bytes(&a[k]);
+	}
+
+	return length;
+}
+
+/**
+ * data_send() - send the capture as a JSON header and typed arrays
+ * @info:	settings, scapture[] and sspectrum[] from iio_sample()
+ * @out:	output, the CGI headers are written too
+ *
+ * Returns the number of bytes in the body, or a negative errno with
+ * nothing written.
+ **/
+int data_send(s_info * info, FILE * out)
+{
+	struct data_array a[DATA_ARRAYS];
+	struct json j;
+	unsigned char *buf, len[4];
+	unsigned n, k, length;
+	int total;
+
+	memset(a, 0, sizeof(a));
+	n = data_arrays(info, a);
+	if (n == 0)
+		return -EINVAL;
+
+	memset(&j, 0, sizeof(j));
+	buf = malloc(DATA_BUF > DATA_JSON ? DATA_BUF : DATA_JSON);
+	if (buf == NULL)
+		return -ENOMEM;
+	j.buf = (char *)buf;
+	j.size = DATA_JSON;
+
+	if (data_header(&j, info, a, n, NULL) < 0) {
+		free(buf);
+		return j.err;
+	}
+
+	length = 4 + j.len;
+	for (k = 0; k < n; k++)
+		length += data_bytes(&a[k]);
+
+	fprintf(out, "Content-type: application/octet-stream\n");
+	fprintf(out, "Content-Length: %u\n", length);
+	fprintf(out, "Cache-Control: no-cache\n\n");
+
+	put_le32(len, j.len);
+	total = fwrite(len, 1, 4, out);
+	total += fwrite(buf, 1, j.len, out);
+	for (k = 0; k < n; k++)
+		total += data_array_write(out, &a[k], buf);
+
+	free(buf);
+
+	return ferror(out) ? -EIO : total;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Downloads ("Acquire Save"): the CGI headers with the length, so
+ * clients show progress, and byte ranges (RFC 7233, a single range),
+ * so interrupted downloads of large captures resume where they broke
+ * off. A download is a stored file, see save_store(); its validator
+ * (ETag and Last-Modified) is its time and size, and a range with an
+ * If-Range that doesn't match gets the whole file. Files go out with
+ * sendfile(), in 64 KiB reads and writes where the kernel can't.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "ndso.h"
+
+#define DOWNLOAD_BUF	65536
+
+/* ETag and Last-Modified of a file */
+static void download_validator(const struct stat *st, char *etag,
+			       char *date, unsigned size)
+{
+	struct tm tm;
+
+	snprintf(etag, size, "\"%lx.%06lx-%llx\"", (long)st->st_mtim.tv_sec,
+		 st->st_mtim.tv_nsec / 1000, (long long)st->st_size);
+	gmtime_r(&st->st_mtim.tv_sec, &tm);
+	strftime(date, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/*
+ * The range the client asks for, from the Range header (HTTP_RANGE).
+ * Anything but a single byte range is ignored and gets the whole
+ * download, as the RFC allows, and so does a range of another version
+ * of the file, as If-Range tells.
+ *
+ * Returns 1 for a partial download, 0 for the whole one, or -ERANGE if
+ * the range is outside of it.
+ */
+static int download_range(long long total, const char *etag,
+			  const char *date, long long *first, long long *last)
+{
+	const char *s = getenv("HTTP_RANGE");
+	const char *match = getenv("HTTP_IF_RANGE");
+	long long a, b;
+	char *end;
+
+	*first = 0;
+	*last = total - 1;
+
+	if (s == NULL || strncmp(s, "bytes=", 6) || strchr(s, ','))
+		return 0;
+	if (match && strcmp(match, etag) && strcmp(match, date))
+		return 0;
+	s += 6;
+
+	if (*s == '-') {
+		/* the last b bytes */
+		b = strtoll(s + 1, &end, 10);
+		if (end == s + 1 || *end || b <= 0)
+			return 0;
+		/* no last bytes of nothing */
+		if (total <= 0)
+			return -ERANGE;
+		*first = b < total ? total - b : 0;
+		return 1;
+	}
+
+	a = strtoll(s, &end, 10);
+	if (end == s || *end != '-' || a < 0)
+		return 0;
+	s = end + 1;
+	b = *s ? strtoll(s, &end, 10) : LLONG_MAX;
+	if ((*s && *end) || b < a)
+		return 0;
+
+	if (a >= total)
+		return -ERANGE;
+	*first = a;
+	*last = b < total ? b : total - 1;
+
+	return 1;
+}
+
+/* CGI headers of a download, range is download_range()'s result */
+static void download_headers(const char *filename, const char *etag,
+			     const char *date, long long total,
+			     long long first, long long last, int range)
+{
+	if (range < 0) {
+		printf("Status: 416 Requested Range Not Satisfiable\n");
+		printf("Content-Range: bytes */%lld\n\n", total);
+		return;
+	}
+	if (range)
+		printf("Status: 206 Partial Content\n");
+	printf("Content-type: application/octet-stream\n");
+	printf("Content-Transfer-Encoding: binary\n");
+	printf("Content-Disposition: attachment; filename=\"%s\"\n", filename);
+	printf("Accept-Ranges: bytes\n");
+	printf("ETag: %s\n", etag);
+	printf("Last-Modified: %s\n", date);
+	if (range)
+		printf("Content-Range: bytes %lld-%lld/%lld\n", first, last,
+		       total);
+	printf("Content-Length: %lld\n\n", last - first + 1);
+}
+
+/* where sendfile() can't write to stdout */
+static int download_copy(int fd, off_t offset, long long count)
+{
+	char *buf;
+	ssize_t n, w, done;
+
+	buf = malloc(DOWNLOAD_BUF);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	while (count > 0) {
+		n = pread(fd, buf, count < DOWNLOAD_BUF ? count : DOWNLOAD_BUF,
+			  offset);
+		if (n <= 0)
+			break;
+		for (done = 0; done < n; done += w) {
+			w = write(1, buf + done, n - done);
+			if (w <= 0) {
+				free(buf);
+				return -EIO;
+			}
+		}
+		offset += n;
+		count -= n;
+	}
+
+	free(buf);
+
+	return count ? -EIO : 0;
+}
+
+/**
+ * download_file() - send a file, or part of it
+ * @path:	file
+ * @filename:	suggested file name
+ * @ranges:	serve the range asked for, 0 for the whole file always
+ *
+ * Returns 0 on success or a negative errno; nothing is sent if the
+ * file doesn't open.
+ **/
+int download_file(const char *path, const char *filename, int ranges)
+{
+	long long first, last, count;
+	char etag[48], date[48];
+	struct stat st;
+	off_t offset;
+	ssize_t n;
+	int fd, range, ret = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	download_validator(&st, etag, date, sizeof(etag));
+	first = 0;
+	last = st.st_size - 1;
+	range = 0;
+	if (ranges)
+		range = download_range(st.st_size, etag, date, &first, &last);
+	download_headers(filename, etag, date, st.st_size, first, last, range);
+	/* the headers go before the file */
+	fflush(stdout);
+	if (range < 0 || st.st_size == 0)
+		goto out;
+
+	offset = first;
+	count = last - first + 1;
+	while (count > 0) {
+		n = sendfile(1, fd, &offset, count);
+		if (n <= 0)
+			break;
+		count -= n;
+	}
+	if (count > 0)
+		ret = download_copy(fd, offset, count);
+
+out:
+	close(fd);
+
+	return ret;
+}
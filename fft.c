@@ -0,0 +1,388 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Floating point FFT, for the paths where the 1024 point Q15 fix_fft()
+ * runs out of length or dynamic range, or the length is not a power
+ * of two.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+/* radix 2 decimation in time, the twiddles come from the caller */
+static void cfft_radix2(float *re, float *im, int n, const float *wr,
+			const float *wi)
+{
+	float tr, ti;
+	int i, j, k, l, istep, step;
+
+	/* decimation in time - re-order data */
+	for (i = 1, j = 0; i < n; i++) {
+		for (k = n >> 1; j & k; k >>= 1)
+			j ^= k;
+		j |= k;
+		if (i < j) {
+			tr = re[i];
+			re[i] = re[j];
+			re[j] = tr;
+			ti = im[i];
+			im[i] = im[j];
+			im[j] = ti;
+		}
+	}
+
+	for (l = 1, step = n / 2; l < n; l = istep, step >>= 1) {
+		istep = l << 1;
+		for (i = 0; i < n; i += istep) {
+			for (k = 0; k < l; k++) {
+				float cr = wr[k * step], ci = wi[k * step];
+				float *ar = re + i + k, *ai = im + i + k;
+				float *br = ar + l, *bi = ai + l;
+
+				tr = cr * *br - ci * *bi;
+				ti = cr * *bi + ci * *br;
+				*br = *ar - tr;
+				*bi = *ai - ti;
+				*ar += tr;
+				*ai += ti;
+			}
+		}
+	}
+}
+
+/* exp(-+j2pi k/n) for k < len, in double before rounding to float */
+static void cfft_twiddle(float *wr, float *wi, int n, int len, int inverse)
+{
+	int k;
+
+	for (k = 0; k < len; k++) {
+		wr[k] = cos(2 * M_PI * k / n);
+		wi[k] = (inverse ? 1 : -1) * sin(2 * M_PI * k / n);
+	}
+}
+
+/* factors of n into 4, 2, 3 and 5, 0 if there are others */
+static int cfft_factor(int n, int *f)
+{
+	static const int radix[] = { 4, 2, 3, 5 };
+	int i, nf = 0;
+
+	for (i = 0; i < 4; i++)
+		while (n % radix[i] == 0) {
+			f[nf++] = radix[i];
+			n /= radix[i];
+		}
+
+	return n == 1 ? nf : 0;
+}
+
+struct cfft_plan {
+	int n;
+	int inverse;
+	int f[32];
+	const float *wr, *wi;	/* n twiddles */
+};
+
+/*
+ * Mixed radix decimation in time, out of place. The input is read
+ * with stride s, the m = n / p point sub-transforms of the p decimated
+ * sequences go to consecutive blocks of the output, which are then
+ * combined by n / p radix p butterflies in place. The twiddle for
+ * W_n^e is the plan's W_N^(e N/n).
+ */
+static void cfft_mixed(const struct cfft_plan *pl, float *yr, float *yi,
+		       const float *xr, const float *xi, int n, int s, int f)
+{
+	int p = pl->f[f], m = n / p, ws = pl->n / n, k, q, r;
+	float ar[5], ai[5], tr, ti;
+
+	if (m == 1) {
+		for (q = 0; q < p; q++) {
+			yr[q] = xr[q * s];
+			yi[q] = xi[q * s];
+		}
+	} else {
+		for (q = 0; q < p; q++)
+			cfft_mixed(pl, yr + q * m, yi + q * m, xr + q * s,
+				   xi + q * s, m, s * p, f + 1);
+	}
+
+	for (k = 0; k < m; k++) {
+		for (q = 0; q < p; q++) {
+			float cr = pl->wr[q * k * ws], ci = pl->wi[q * k * ws];
+			float br = yr[q * m + k], bi = yi[q * m + k];
+
+			ar[q] = cr * br - ci * bi;
+			ai[q] = cr * bi + ci * br;
+		}
+
+		switch (p) {
+		case 2:
+			yr[k] = ar[0] + ar[1];
+			yi[k] = ai[0] + ai[1];
+			yr[m + k] = ar[0] - ar[1];
+			yi[m + k] = ai[0] - ai[1];
+			break;
+		case 4: {
+			/* -j for the forward transform, +j for the inverse */
+			float s0r = ar[0] + ar[2], s0i = ai[0] + ai[2];
+			float d0r = ar[0] - ar[2], d0i = ai[0] - ai[2];
+			float s1r = ar[1] + ar[3], s1i = ai[1] + ai[3];
+			float d1r = ar[1] - ar[3], d1i = ai[1] - ai[3];
+
+			if (pl->inverse) {
+				tr = -d1i;
+				ti = d1r;
+			} else {
+				tr = d1i;
+				ti = -d1r;
+			}
+			yr[k] = s0r + s1r;
+			yi[k] = s0i + s1i;
+			yr[m + k] = d0r + tr;
+			yi[m + k] = d0i + ti;
+			yr[2 * m + k] = s0r - s1r;
+			yi[2 * m + k] = s0i - s1i;
+			yr[3 * m + k] = d0r - tr;
+			yi[3 * m + k] = d0i - ti;
+			break;
+		}
+		default:
+			/* 3 and 5, a direct DFT is short enough */
+			for (r = 0; r < p; r++) {
+				tr = ar[0];
+				ti = ai[0];
+				for (q = 1; q < p; q++) {
+					int e = (q * r) % p * m * ws;
+
+					tr += pl->wr[e] * ar[q] - pl->wi[e] * ai[q];
+					ti += pl->wr[e] * ai[q] + pl->wi[e] * ar[q];
+				}
+				yr[r * m + k] = tr;
+				yi[r * m + k] = ti;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Bluestein: nk = (k^2 + n^2 - (k-n)^2) / 2 turns the DFT into a
+ * convolution with the chirp exp(+-j pi k^2/n), done by power of two
+ * FFTs of at least 2n - 1 points. k^2 is reduced mod 2n in integers,
+ * the chirp stays accurate for long transforms.
+ */
+static int cfft_bluestein(float *re, float *im, int n, int inverse)
+{
+	float *cr, *ci, *ar, *ai, *br, *bi, *wr, *wi, tr, ti;
+	int m, k;
+	long long k2;
+	double ph;
+
+	for (m = 1; m < 2 * n - 1; m <<= 1) ;
+
+	cr = malloc((2 * n + 5 * m) * sizeof(float));
+	if (cr == NULL)
+		return -1;
+	ci = cr + n;
+	ar = ci + n;
+	ai = ar + m;
+	br = ai + m;
+	bi = br + m;
+	wr = bi + m;
+	wi = wr + m / 2;
+
+	for (k = 0; k < n; k++) {
+		k2 = (long long)k * k % (2 * n);
+		ph = (inverse ? 1 : -1) * M_PI * k2 / n;
+		cr[k] = cos(ph);
+		ci[k] = sin(ph);
+	}
+
+	for (k = 0; k < m; k++)
+		ar[k] = ai[k] = br[k] = bi[k] = 0;
+	for (k = 0; k < n; k++) {
+		ar[k] = re[k] * cr[k] - im[k] * ci[k];
+		ai[k] = re[k] * ci[k] + im[k] * cr[k];
+	}
+	br[0] = cr[0];
+	bi[0] = -ci[0];
+	for (k = 1; k < n; k++) {
+		br[k] = br[m - k] = cr[k];
+		bi[k] = bi[m - k] = -ci[k];
+	}
+
+	cfft_twiddle(wr, wi, m, m / 2, 0);
+	cfft_radix2(ar, ai, m, wr, wi);
+	cfft_radix2(br, bi, m, wr, wi);
+
+	/* conjugate in and out makes the forward FFT an inverse one */
+	for (k = 0; k < m; k++) {
+		tr = ar[k] * br[k] - ai[k] * bi[k];
+		ti = ar[k] * bi[k] + ai[k] * br[k];
+		ar[k] = tr;
+		ai[k] = -ti;
+	}
+	cfft_radix2(ar, ai, m, wr, wi);
+
+	for (k = 0; k < n; k++) {
+		tr = ar[k] / m;
+		ti = -ai[k] / m;
+		re[k] = tr * cr[k] - ti * ci[k];
+		im[k] = tr * ci[k] + ti * cr[k];
+	}
+
+	free(cr);
+
+	return 0;
+}
+
+/**
+ * cfft() - in place complex FFT
+ * @re:		real parts, n values
+ * @im:		imaginary parts, n values
+ * @n:		transform length, any length from 1
+ * @inverse:	0 = forward, exp(-j2pi nk/N); 1 = inverse, exp(+j2pi nk/N)
+ *
+ * Powers of two use radix 2, lengths with no prime factors other than
+ * 2, 3 and 5 use mixed radix, all others Bluestein's algorithm, which
+ * costs about three power of two FFTs of twice the length.
+ * Neither direction is scaled.
+ * Returns 0 on success, -1 for an unsupported length or no memory.
+ **/
+int cfft(float *re, float *im, int n, int inverse)
+{
+	struct cfft_plan pl;
+	float *w, *yr, *yi;
+	int i;
+
+	if (n < 1)
+		return -1;
+
+	if (!(n & (n - 1))) {
+		w = malloc(n * sizeof(float));
+		if (w == NULL)
+			return -1;
+		cfft_twiddle(w, w + n / 2, n, n / 2, inverse);
+		cfft_radix2(re, im, n, w, w + n / 2);
+		free(w);
+		return 0;
+	}
+
+	if (!cfft_factor(n, pl.f))
+		return cfft_bluestein(re, im, n, inverse);
+
+	w = malloc(4 * n * sizeof(float));
+	if (w == NULL)
+		return -1;
+	yr = w + 2 * n;
+	yi = yr + n;
+
+	cfft_twiddle(w, w + n, n, n, inverse);
+	pl.n = n;
+	pl.inverse = inverse;
+	pl.wr = w;
+	pl.wi = w + n;
+	cfft_mixed(&pl, yr, yi, re, im, n, 1, 0);
+
+	for (i = 0; i < n; i++) {
+		re[i] = yr[i];
+		im[i] = yi[i];
+	}
+
+	free(w);
+
+	return 0;
+}
+
+/**
+ * cfft_power() - power spectrum of a capture through cfft()
+ * @pwr:	bins, scaled like fix_power() of a fix_fft() spectrum
+ * @nbins:	bins to compute, n / 2, or n for a complex input
+ * @data:	interleaved capture, samples_per_scan values per sample
+ * @n:		samples, the transform length
+ * @samples_per_scan: values per sample in @data
+ * @mask:	channel mask; 3 transforms ch0 + j ch1, as the Q15 path
+ * @windowed:	apply fwindow() first
+ *
+ * Returns 0 on success, -1 for no memory.
+ **/
+int cfft_power(float *pwr, unsigned nbins, const short *data, unsigned n,
+	       unsigned samples_per_scan, unsigned mask, int windowed)
+{
+	float *fr, *fi;
+	unsigned i;
+	int ret;
+
+	fr = malloc(2 * n * sizeof(float));
+	if (fr == NULL)
+		return -1;
+	fi = fr + n;
+
+	for (i = 0; i < n; i++) {
+		fr[i] = data[i * samples_per_scan + (mask == 2)];
+		fi[i] = mask == 3 ? data[i * samples_per_scan + 1] : 0;
+	}
+
+	if (windowed) {
+		fwindow(fr, n);
+		fwindow(fi, n);
+	}
+
+	ret = cfft(fr, fi, n, 0);
+
+	/* fix_fft() divides by N */
+	for (i = 0; i < nbins; i++)
+		pwr[i] = (fr[i] * fr[i] + fi[i] * fi[i]) / ((float)n * n);
+
+	free(fr);
+
+	return ret;
+}
+
+static void reverse(float *x, unsigned n)
+{
+	unsigned i;
+	float t;
+
+	for (i = 0; i < n / 2; i++) {
+		t = x[i];
+		x[i] = x[n - 1 - i];
+		x[n - 1 - i] = t;
+	}
+}
+
+/**
+ * fftshift() - move the negative frequencies of a spectrum in front
+ * @x:		n bins, DC first; DC ends up at n / 2
+ * @n:		number of bins, odd lengths too
+ *
+ * A rotation left by (n + 1) / 2, done in place by three reversals.
+ **/
+void fftshift(float *x, unsigned n)
+{
+	unsigned r = (n + 1) / 2;
+
+	reverse(x, r);
+	reverse(x + r, n - r);
+	reverse(x, n);
+}
+
+/**
+ * fwindow() - apply a Hanning window, same shape as window() in int_fft.c
+ * @x:		samples
+ * @n:		number of samples
+ **/
+void fwindow(float *x, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		x[i] *= 0.5f - 0.5f * cosf(2 * M_PI * i / n);
+}
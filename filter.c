@@ -0,0 +1,311 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Filter stage, run on the decoded capture before it is displayed or
+ * transformed. FIR filters are either Q15, computed with fix_dot(),
+ * or float, computed directly or by overlap-save FFT convolution for
+ * long filters. IIR filters are float biquad cascades.
+ *
+ * Coefficient files live in FILENAME_COEF and hold whitespace
+ * separated numbers, '#' starts a comment. FIR files list the taps;
+ * if all of them are integers they are Q15, like Low_pass[]. IIR
+ * files list b0 b1 b2 a0 a1 a2 per second order section.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define FILTER_MAX_COEF		4096
+#define FIR_DIRECT_TAPS		64	/* longer FIRs go through the FFT */
+
+static int filter_read(filter_set * f, FILE * fp)
+{
+	double v[FILTER_MAX_COEF];
+	char line[256], *p, *end;
+	int n = 0, q15 = 1, i, k;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if ((p = strchr(line, '#')))
+			*p = 0;
+		for (p = line; n < FILTER_MAX_COEF; p = end) {
+			v[n] = strtod(p, &end);
+			if (end == p)
+				break;
+			if (v[n] != floor(v[n]) || fabs(v[n]) > 32767)
+				q15 = 0;
+			n++;
+		}
+	}
+
+	if (n == 0)
+		return -EINVAL;
+
+	if (f->type == FILTER_IIR) {
+		if (n % 6)
+			return -EINVAL;
+		for (i = 0; i < n; i += 6)
+			if (v[i + 3] == 0)
+				return -EINVAL;
+		f->taps = malloc(n / 6 * 5 * sizeof(float));
+		if (f->taps == NULL)
+			return -ENOMEM;
+		/* b0 b1 b2 a1 a2, normalized to a0 = 1 */
+		for (i = 0, k = 0; i < n; i += 6) {
+			f->taps[k++] = v[i] / v[i + 3];
+			f->taps[k++] = v[i + 1] / v[i + 3];
+			f->taps[k++] = v[i + 2] / v[i + 3];
+			f->taps[k++] = v[i + 4] / v[i + 3];
+			f->taps[k++] = v[i + 5] / v[i + 3];
+		}
+		f->ntaps = n / 6;
+		return 0;
+	}
+
+	f->taps = malloc(n * (sizeof(float) + sizeof(short)));
+	if (f->taps == NULL)
+		return -ENOMEM;
+	f->qtaps = (short *)(f->taps + n);
+	f->q15 = q15;
+	f->ntaps = n;
+
+	/* stored reversed, so a tap lines up with the oldest sample */
+	for (i = 0; i < n; i++) {
+		f->taps[n - 1 - i] = q15 ? v[i] / 32768 : v[i];
+		f->qtaps[n - 1 - i] = q15 ? v[i] : 0;
+	}
+
+	return 0;
+}
+
+/**
+ * filter_load() - set up the filter selected in sfilter.type
+ * @info:	settings
+ * @name:	coefficient file in FILENAME_COEF, for FIR and IIR
+ *
+ * Returns 0 on success or a negative errno.
+ **/
+int filter_load(s_info * info, const char *name)
+{
+	filter_set *f = &info->sfilter;
+	char *filename;
+	FILE *fp;
+	int ret;
+
+	switch (f->type) {
+	case FILTER_OFF:
+		return 0;
+	case FILTER_LOW_PASS:
+		f->qtaps = Low_pass;
+		f->ntaps = N_LOW_PASS;
+		f->q15 = 1;
+		return 0;
+	case FILTER_FIR:
+	case FILTER_IIR:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* only plain names, the files come from a fixed directory */
+	if (name == NULL || name[0] == 0 || name[0] == '.' || strchr(name, '/'))
+		return -EINVAL;
+
+	if (asprintf(&filename, "%s%s", FILENAME_COEF, name) < 0)
+		return -ENOMEM;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		syslog(LOG_INFO, "Failed to open %s\n", filename);
+		free(filename);
+		return -ENOENT;
+	}
+	free(filename);
+
+	ret = filter_read(f, fp);
+	fclose(fp);
+
+	return ret;
+}
+
+/* x holds m - 1 samples of history in front of the n inputs */
+static void fir_q15(float *y, const short *x, const short *hr, int m, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		y[i] = fix_dot((fixed *)hr, (fixed *)x + i, m);
+}
+
+static void fir_direct(float *y, const float *x, const float *hr, int m, int n)
+{
+	int i, k;
+
+	for (i = 0; i < n; i++) {
+		float acc = 0;
+
+		for (k = 0; k < m; k++)
+			acc += hr[k] * x[i + k];
+		y[i] = acc;
+	}
+}
+
+/* overlap-save block length for m taps */
+static int fir_ols_len(int m)
+{
+	int l;
+
+	for (l = 64; l < 4 * m; l <<= 1) ;
+
+	return l;
+}
+
+/*
+ * Overlap-save. Blocks of l samples overlap by m - 1, each gives
+ * l - m + 1 outputs. Two blocks share one complex FFT, real and
+ * imaginary part, which stay apart since the filter is real.
+ * x must be readable, zero padded, up to n + m - 1 + 2 l samples.
+ */
+static int fir_ols(float *y, const float *x, const float *hr, int m, int n)
+{
+	float *hre, *him, *zr, *zi, a, b;
+	int l = fir_ols_len(m), step = l - m + 1;
+	int i, k, pos, cnt;
+
+	hre = calloc(4 * l, sizeof(float));
+	if (hre == NULL)
+		return -ENOMEM;
+	him = hre + l;
+	zr = him + l;
+	zi = zr + l;
+
+	/* un-reverse the taps, scaled for the unscaled inverse FFT */
+	for (k = 0; k < m; k++)
+		hre[k] = hr[m - 1 - k] / l;
+	cfft(hre, him, l, 0);
+
+	for (pos = 0; pos < n; pos += 2 * step) {
+		memcpy(zr, x + pos, l * sizeof(float));
+		memcpy(zi, x + pos + step, l * sizeof(float));
+
+		cfft(zr, zi, l, 0);
+		for (k = 0; k < l; k++) {
+			a = zr[k] * hre[k] - zi[k] * him[k];
+			b = zr[k] * him[k] + zi[k] * hre[k];
+			zr[k] = a;
+			zi[k] = b;
+		}
+		cfft(zr, zi, l, 1);
+
+		cnt = n - pos < step ? n - pos : step;
+		for (i = 0; i < cnt; i++)
+			y[pos + i] = zr[m - 1 + i];
+		cnt = n - pos - step < step ? n - pos - step : step;
+		for (i = 0; i < cnt; i++)
+			y[pos + step + i] = zi[m - 1 + i];
+	}
+
+	free(hre);
+
+	return 0;
+}
+
+/*
+ * Biquad cascade, transposed direct form II. Each section runs over
+ * the whole block before the next one, which keeps the recursion in
+ * registers; it can't be vectorized along the time axis.
+ */
+static void iir_biquad(float *y, const float *sos, int sections, int n)
+{
+	int s, i;
+
+	for (s = 0; s < sections; s++, sos += 5) {
+		float b0 = sos[0], b1 = sos[1], b2 = sos[2];
+		float a1 = sos[3], a2 = sos[4];
+		float z1 = 0, z2 = 0, in, out;
+
+		for (i = 0; i < n; i++) {
+			in = y[i];
+			out = b0 * in + z1;
+			z1 = b1 * in - a1 * out + z2;
+			z2 = b2 * in - a2 * out;
+			y[i] = out;
+		}
+	}
+}
+
+/**
+ * filter_capture() - filter every channel of a capture in place
+ * @info:	settings, sfilter as set up by filter_load()
+ * @data:	interleaved capture, samples_per_scan values per sample
+ * @samples:	samples per channel
+ * @samples_per_scan: values per sample in @data
+ *
+ * The filters start from rest, with zeros before the capture.
+ * Returns 0 on success or a negative errno.
+ **/
+int filter_capture(s_info * info, short *data, unsigned samples,
+		   unsigned samples_per_scan)
+{
+	filter_set *f = &info->sfilter;
+	int m = (f->type == FILTER_IIR) ? 1 : f->ntaps;
+	int ols = !f->q15 && m > FIR_DIRECT_TAPS;
+	unsigned c, i, pad = m - 1;
+	float *x, *y, v;
+	short *xq;
+	size_t len;
+	int ret = 0;
+
+	if (f->type == FILTER_OFF || f->ntaps == 0)
+		return 0;
+
+	/* room for the history in front and overlap-save behind */
+	len = samples + pad + (ols ? 2 * fir_ols_len(m) : 0);
+	x = calloc(len + samples, sizeof(float) + sizeof(short));
+	if (x == NULL)
+		return -ENOMEM;
+	y = x + len;
+	xq = (short *)(y + samples);
+
+	for (c = 0; c < samples_per_scan; c++) {
+		const short *d = data + c;
+
+		if (f->type == FILTER_IIR) {
+			for (i = 0; i < samples; i++)
+				y[i] = d[i * samples_per_scan];
+			iir_biquad(y, f->taps, f->ntaps, samples);
+		} else if (f->q15) {
+			for (i = 0; i < samples; i++)
+				xq[pad + i] = d[i * samples_per_scan];
+			fir_q15(y, xq, f->qtaps, m, samples);
+		} else {
+			for (i = 0; i < samples; i++)
+				x[pad + i] = d[i * samples_per_scan];
+			if (ols)
+				ret = fir_ols(y, x, f->taps, m, samples);
+			else
+				fir_direct(y, x, f->taps, m, samples);
+			if (ret < 0)
+				break;
+		}
+
+		for (i = 0; i < samples; i++) {
+			v = y[i];
+			v = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+			data[c + i * samples_per_scan] = lrintf(v);
+		}
+	}
+
+	free(x);
+
+	return ret;
+}
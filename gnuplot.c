@@ -0,0 +1,377 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Persistent gnuplot co-process. Every request is a new CGI process, so
+ * the co-process belongs to the session (remote address) instead. It is
+ * started detached on first use with its stdin on a FIFO, which it holds
+ * open for reading and writing itself, so it never sees end of file and
+ * stays up for the following requests. Sessions end without a word, so
+ * a watcher started with it ends it once the session has been idle for
+ * GP_IDLE seconds. Time domain and FFT traces go
+ * down the FIFO inline, as binary arrays straight from memory; the
+ * other displays load the session script. gnuplot acknowledges the
+ * finished image through a second FIFO.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "ndso.h"
+
+#define GP_POLL_MS	50
+#define GP_START_MS	2000	/* for a new gnuplot to open its FIFO */
+#define GP_IDLE		300	/* seconds without a request, then it exits */
+#define GP_WATCH	30	/* seconds between looks at the pid file */
+
+struct gp {
+	char *fifo;
+	char *ack;
+	char *pid;
+	int lock;		/* the pid file, locked for the exchange */
+	pid_t gnuplot;
+};
+
+static pid_t gnuplot_pid(struct gp *gp)
+{
+	char buf[16];
+	ssize_t len;
+
+	len = pread(gp->lock, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	return atoi(buf);
+}
+
+/*
+ * Every request touches the pid file under its lock, so its time is
+ * that of the last one. Taking the lock too, this never ends gnuplot
+ * in the middle of an exchange; it leaves once its gnuplot is gone or
+ * has been replaced by a new one.
+ */
+static void gnuplot_watch(struct gp *gp, pid_t gnuplot)
+{
+	struct stat st;
+	int i;
+
+	/* the CGI output too, or the request never ends */
+	for (i = 0; i < 256; i++)
+		close(i);
+
+	for (;;) {
+		sleep(GP_WATCH);
+		gp->lock = open(gp->pid, O_RDWR);
+		if (gp->lock < 0 || kill(gnuplot, 0) < 0)
+			break;
+		flock(gp->lock, LOCK_EX);
+		if (gnuplot_pid(gp) != gnuplot)
+			break;
+		if (fstat(gp->lock, &st) == 0 &&
+		    time(NULL) - st.st_mtime > GP_IDLE) {
+			kill(gnuplot, SIGKILL);
+			ftruncate(gp->lock, 0);
+			break;
+		}
+		close(gp->lock);
+	}
+
+	_exit(0);
+}
+
+/* started from a child, so it is not ours to wait for */
+static int gnuplot_spawn(struct gp *gp)
+{
+	char buf[16];
+	pid_t child, pid;
+	int fd, i, len, status;
+
+	if ((mkfifo(gp->fifo, 0600) < 0 && errno != EEXIST) ||
+	    (mkfifo(gp->ack, 0600) < 0 && errno != EEXIST))
+		return -errno;
+
+	if (ftruncate(gp->lock, 0) < 0)
+		return -errno;
+
+	child = fork();
+	if (child < 0)
+		return -errno;
+
+	if (child == 0) {
+		setsid();
+		pid = fork();
+		if (pid == 0) {
+			fd = open(gp->fifo, O_RDWR);
+			if (fd < 0)
+				_exit(127);
+			dup2(fd, 0);
+			/* off the CGI output, or the request never ends */
+			fd = open("/dev/null", O_WRONLY);
+			dup2(fd, 1);
+			dup2(fd, 2);
+			for (i = 3; i < 256; i++)
+				close(i);
+			execl(GNUPLOT_BIN, "gnuplot", NULL);
+			_exit(127);
+		}
+		len = snprintf(buf, sizeof(buf), "%d\n", pid > 0 ? pid : 0);
+		if (pwrite(gp->lock, buf, len, 0) != len || pid <= 0)
+			_exit(1);
+		if (fork() == 0)
+			gnuplot_watch(gp, pid);
+		_exit(0);
+	}
+
+	if (waitpid(child, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status))
+		return -ECHILD;
+
+	gp->gnuplot = gnuplot_pid(gp);
+
+	return 0;
+}
+
+/*
+ * The FIFO opens for writing only while gnuplot holds it, which also
+ * tells whether the co-process is still there.
+ */
+static int gnuplot_connect(struct gp *gp)
+{
+	int fd, t, ret;
+
+	gp->gnuplot = gnuplot_pid(gp);
+	if (gp->gnuplot > 0 && kill(gp->gnuplot, 0) == 0) {
+		fd = open(gp->fifo, O_WRONLY | O_NONBLOCK);
+		if (fd >= 0)
+			goto connected;
+		kill(gp->gnuplot, SIGKILL);
+	}
+
+	ret = gnuplot_spawn(gp);
+	if (ret < 0)
+		return ret;
+
+	for (t = 0; t < GP_START_MS; t += GP_POLL_MS) {
+		fd = open(gp->fifo, O_WRONLY | O_NONBLOCK);
+		if (fd >= 0)
+			goto connected;
+		if (kill(gp->gnuplot, 0) < 0)
+			break;
+		usleep(GP_POLL_MS * 1000);
+	}
+
+	return -ENXIO;
+
+connected:
+	/* the binary traces are larger than the FIFO */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+	return fd;
+}
+
+/* gnuplot exits on a script error, so don't wait out the timeout then */
+static int gnuplot_wait(struct gp *gp, int ack)
+{
+	struct pollfd pfd = { ack, POLLIN, 0 };
+	char buf[64];
+	ssize_t len;
+	int t;
+
+	for (t = 0; t < TIMEOUT * 1000; t += GP_POLL_MS) {
+		if (poll(&pfd, 1, GP_POLL_MS) > 0) {
+			len = read(ack, buf, sizeof(buf) - 1);
+			if (len > 0) {
+				buf[len] = 0;
+				return strstr(buf, "done") ? 0 : -EIO;
+			}
+		}
+		if (kill(gp->gnuplot, 0) < 0)
+			return -ECHILD;
+	}
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Samples are sent as they are in the capture, de-interleaved; spectra
+ * as they are in memory.
+ */
+static int gnuplot_data(FILE * fp, const s_plot * p)
+{
+	const plot_trace *t;
+	short *buf = NULL;
+	unsigned k, i;
+
+	for (k = 0; k < p->ntraces; k++) {
+		t = &p->trace[k];
+		if (t->f) {
+			fwrite(t->f, sizeof(float), t->n, fp);
+			continue;
+		}
+		if (t->stride == 1) {
+			fwrite(t->s, sizeof(short), t->n, fp);
+			continue;
+		}
+		if (buf == NULL) {
+			buf = malloc(t->n * sizeof(short));
+			if (buf == NULL)
+				return -ENOMEM;
+		}
+		for (i = 0; i < t->n; i++)
+			buf[i] = t->s[i * t->stride];
+		fwrite(buf, sizeof(short), t->n, fp);
+	}
+
+	free(buf);
+
+	return ferror(fp) ? -EPIPE : 0;
+}
+
+/**
+ * gnuplot_plot_binary() - plot command reading the traces inline
+ * @fp:		script
+ * @p:		traces, from plot_traces()
+ *
+ * One '-' source per trace, in the order gnuplot_data() sends them.
+ **/
+void gnuplot_plot_binary(FILE * fp, const s_plot * p)
+{
+	const plot_trace *t;
+	unsigned k;
+
+	fprintf(fp, "plot ");
+	for (k = 0; k < p->ntraces; k++) {
+		t = &p->trace[k];
+		fprintf(fp, "%s'-' binary array=(%u) format='%s' using ($0*%g%+g):1 title \"%s\"",
+			k ? ", " : "", t->n, t->f ? "%float" : "%int16",
+			t->dx, t->x0, t->title);
+	}
+	fprintf(fp, "\n");
+}
+
+/**
+ * gnuplot_render() - plot through the session's gnuplot co-process
+ * @info:	settings, the retained captures and spectra
+ * @postvars:	request, for the plot options
+ *
+ * The time domain and software FFT traces are sent inline, the other
+ * displays load the script written by make_file_init().
+ *
+ * Returns 0 once the image is written, or a negative errno. The
+ * co-process is killed on errors, the next request starts a new one.
+ **/
+int gnuplot_render(s_info * info, char **postvars)
+{
+	struct gp gp;
+	s_plot *p = NULL;
+	FILE *fp = NULL;
+	char buf[64];
+	int fd, ack = -1, ret;
+
+	memset(&gp, 0, sizeof(gp));
+	gp.lock = -1;
+	if (asprintf(&gp.fifo, "%s%s", FILENAME_GP_FIFO, info->pREMOTE_ADDR) < 0 ||
+	    asprintf(&gp.ack, "%s%s", FILENAME_GP_ACK, info->pREMOTE_ADDR) < 0 ||
+	    asprintf(&gp.pid, "%s%s", FILENAME_GP_PID, info->pREMOTE_ADDR) < 0) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (plot_retained(info)) {
+		p = calloc(1, sizeof(*p));
+		if (p == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		plot_options(info, p, postvars);
+		ret = plot_traces(info, p, postvars);
+		if (ret < 0)
+			goto out;
+		plot_reduce(p, 0);
+	}
+
+	gp.lock = open(gp.pid, O_RDWR | O_CREAT, 0644);
+	if (gp.lock < 0) {
+		ret = -errno;
+		goto out;
+	}
+	flock(gp.lock, LOCK_EX);
+	/* the session is in use, see gnuplot_watch() */
+	futimes(gp.lock, NULL);
+
+	fd = gnuplot_connect(&gp);
+	if (fd < 0) {
+		ret = fd;
+		goto out;
+	}
+
+	fp = fdopen(fd, "w");
+	/* read/write, so poll() waits for the answer instead of a hang up */
+	ack = open(gp.ack, O_RDWR | O_NONBLOCK);
+	if (fp == NULL || ack < 0) {
+		if (fp == NULL)
+			close(fd);
+		ret = -errno;
+		goto out;
+	}
+
+	/* left over from an exchange that timed out */
+	while (read(ack, buf, sizeof(buf)) > 0)
+		;
+
+	/* a dead co-process shows up as a write error, not a signal */
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(fp, "reset\nset term png\nset output \"%s\"\n",
+		info->pFILENAME_IMG);
+	if (p) {
+		info->pFile_init = fp;
+		plot_script(info, postvars, p);
+		ret = gnuplot_data(fp, p);
+	} else {
+		fprintf(fp, "load \"%s\"\n", info->pFILENAME_GNUPLT);
+		ret = 0;
+	}
+	fprintf(fp, "set output\nset print \"%s\"\nprint \"done\"\nset print\n",
+		gp.ack);
+
+	if (fflush(fp) || ret < 0)
+		ret = -EPIPE;
+	else
+		ret = gnuplot_wait(&gp, ack);
+
+out:
+	if (ret < 0) {
+		syslog(LOG_INFO, "gnuplot co-process failed (%d)\n", ret);
+		if (gp.gnuplot > 0)
+			kill(gp.gnuplot, SIGKILL);
+	}
+	if (fp)
+		fclose(fp);
+	if (ack >= 0)
+		close(ack);
+	if (gp.lock >= 0)
+		close(gp.lock);
+	free(gp.fifo);
+	free(gp.ack);
+	free(gp.pid);
+	free(p);
+
+	return ret;
+}
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/dir.h>
 #include <linux/types.h>
 #include <syslog.h>
@@ -32,8 +33,6 @@
 #include "ndso.h"
 #include "iio_utils.h"
 
-#define BINARY_OFFSET		0
-
 unsigned samples_per_scan = 2;
 
 //#define BINARY_OFFSET		0
@@ -64,13 +63,14 @@ int size_from_channelarray(struct iio_channel_info *channels, int num_channels)
 
 /**
  * process_scan() - print out the values in SI units
+ * @t:			output, see text_open()
  * @data:		pointer to the start of the scan
  * @infoarray:		information about the channels. Note
  *  size_from_channelarray must have been called first to fill the
  *  location offsets.
  * @num_channels:	the number of active channels
  **/
-void process_scan(s_info * info,
+void process_scan(s_text * t,
 		  char *data,
 		  struct iio_channel_info *infoarray,
 		  int num_channels, unsigned scan_size, int64_t tstmp)
@@ -88,18 +88,16 @@ void process_scan(s_info * info,
 				if ((val >> infoarray[k].bits_used) & 1)
 					val = (val & infoarray[k].mask) |
 					    ~infoarray[k].mask;
-				fprintf(info->pFile_samples, "%05f ",
-					((float)val +
-					 infoarray[k].offset) *
-					infoarray[k].scale);
+				text_fixed(t, ((float)val +
+					    infoarray[k].offset) *
+					   infoarray[k].scale, 6, ' ');
 			} else {
 				uint16_t val = *(uint16_t *)
 				    (data + infoarray[k].location);
 				val = (val & infoarray[k].mask);
-				fprintf(info->pFile_samples, "%05f ",
-					((float)val +
-					 infoarray[k].offset) *
-					infoarray[k].scale);
+				text_fixed(t, ((float)val +
+					    infoarray[k].offset) *
+					   infoarray[k].scale, 6, ' ');
 			}
 			break;
 		case 8:
@@ -112,13 +110,12 @@ void process_scan(s_info * info,
 				/* special case for timestamp */
 				if (infoarray[k].scale == 1.0f &&
 				    infoarray[k].offset == 0.0f)
-					fprintf(info->pFile_samples, "%lld ",
-						(long long int)(val  - tstmp));
+					text_int(t, (long long int)(val  - tstmp),
+						 ' ');
 				else
-					fprintf(info->pFile_samples, "%05f ",
-						((float)val +
-						 infoarray[k].offset) *
-						infoarray[k].scale);
+					text_fixed(t, ((float)val +
+						    infoarray[k].offset) *
+						   infoarray[k].scale, 6, ' ');
 			}
 			break;
 		default:
@@ -126,7 +123,7 @@ void process_scan(s_info * info,
 		}
 
 	}
-	fprintf(info->pFile_samples, "\n");
+	text_char(t, '\n');
 
 }
 
@@ -423,6 +420,7 @@ int iio_sample(int form_method, char **getvars, char **postvars, s_info * info,
 	int cnt;
 	char *dev_dir_name, *buf_dir_name, *saved_device_name = NULL, *pFILENAME_T_OUT;
 	FILE *file_samples;
+	s_text text;
 #if BINARY_OFFSET > 0
 	unsigned short *data;
 #else
@@ -431,6 +429,9 @@ int iio_sample(int form_method, char **getvars, char **postvars, s_info * info,
 	size_t read_size;
 	int dev_num;
 	char *buffer_access;
+	s_capture *capture;
+	struct timeval tv;
+	int board, err = 0;
 
 //	syslog(LOG_INFO, "device_name = %s, device_name_slave %s\n", device_name, device_name_slave);
 
@@ -521,29 +522,79 @@ int iio_sample(int form_method, char **getvars, char **postvars, s_info * info,
 		goto error_close_buffer_access;
 
 	}
+	/*
+	 * these send the retained capture, see data_send(), stream_run()
+	 * and save_store()
+	 */
+	text_open(&text, (info->run == DATA || info->run == LIVE ||
+			  info->run == MEASURE ||
+			  (info->run == SAVE &&
+			   info->sdisplay.save_fmt != SAVE_TEXT)) ?
+		  NULL : file_samples);
 
+	gettimeofday(&tv, NULL);
 	read_size = read(fp, data, buf_len);
 	if (read_size == -EAGAIN) {
 		syslog(LOG_INFO, "nothing available\n");
 	}
 
-	if (info->sdisplay.tdom) {
+	/* results of the master go to index 0 (LPC), the slave's to 1 (HPC) */
+	board = pFILENAME_T_OUT == info->pFILENAME_T_OUT2;
+
+	/* the HW FFT output is a spectrum already */
+	if (info->sfilter.type && (info->sdisplay.tdom || !info->sdisplay.hw_fft)) {
+		ret = filter_capture(info, (short *)data, info->stime_s.samples,
+				     samples_per_scan);
+		if (ret < 0)
+			syslog(LOG_INFO, "filter_capture failed (%d)\n", ret);
+	}
+
+	if (info->run == TONE) {
+		/* measured from the retained capture, see tone_report() */
+	} else if (info->run == SAVE && info->sdisplay.save_fmt != SAVE_TEXT) {
+		/* stored from the retained capture, see save_store() */
+	} else if (info->sdisplay.tdom) {
 		iio_stats(info, info->stime_s.samples, data);
 		switch (info->channel_en_mask) {
 		case 3:
-			for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan)
-				fprintf(file_samples, "%d %d %d\n", data[i] - BINARY_OFFSET, data[i+1] - BINARY_OFFSET, i >> 1);
+			for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan) {
+				text_int(&text, data[i] - BINARY_OFFSET, ' ');
+				text_int(&text, data[i+1] - BINARY_OFFSET, ' ');
+				text_int(&text, i >> 1, '\n');
+			}
 
 			break;
 		case 1:
 			for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan)
-				fprintf(file_samples, "%d\n", data[i] - BINARY_OFFSET);
+				text_int(&text, data[i] - BINARY_OFFSET, '\n');
 			break;
 		case 2:
 			for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan)
-				fprintf(file_samples, "%d\n", data[i+1] - BINARY_OFFSET);
+				text_int(&text, data[i+1] - BINARY_OFFSET, '\n');
 			break;
 		}
+
+		if (info->sdisplay.persist && board == 0) {
+			ret = persist_sample(info, (short *)data, samples_per_scan);
+			if (ret < 0)
+				syslog(LOG_INFO, "persist_sample failed (%d)\n", ret);
+		}
+	} else if (info->sdisplay.cross) {
+		/* needs both captures, cross_sample() runs once they are in */
+	} else if (info->sdisplay.zoom) {
+		ret = zoom_sample(info, device_name, data, samples_per_scan,
+				  file_samples, &info->smarkers[board]);
+		if (ret < 0)
+			syslog(LOG_INFO, "zoom_sample failed (%d)\n", ret);
+		/* a span the capture can't resolve is the user's to fix */
+		if (ret == -ERANGE)
+			err = ret;
+	} else if (info->sdisplay.waterfall) {
+		ret = waterfall_sample(info, data, samples_per_scan, file_samples,
+				       pFILENAME_T_OUT == info->pFILENAME_T_OUT,
+				       &info->smarkers[board]);
+		if (ret < 0)
+			syslog(LOG_INFO, "waterfall_sample failed (%d)\n", ret);
 	} else if (info->sdisplay.hw_fft) {
 		short *real;
 		short *imag;
@@ -571,72 +622,146 @@ int iio_sample(int form_method, char **getvars, char **postvars, s_info * info,
 
 		for (i = info->sdisplay.fftexludezero;
        			i < (info->stime_s.samples / 2); i++) {
-       				fprintf (file_samples, "%d %d\n", i, real[i]);
+       				text_int(&text, i, ' ');
+       				text_int(&text, real[i], '\n');
 		}
 
 		free(real);
 
 	} else {
-		short *real;
-		short *imag;
-		short *amp;
-
-		real = malloc(((2 * info->stime_s.samples) + (info->stime_s.samples / 2)) * sizeof(short));
-		if (real == NULL){
+		int32_t *real;
+		int32_t *imag;
+		float *amp;
+		float *hold;
+		int exponent;
+		/* I/Q baseband: all bins, negative frequencies first */
+		unsigned iq = info->sdisplay.iq && info->channel_en_mask == 3;
+		unsigned nbins = iq ? info->stime_s.samples : info->stime_s.samples / 2;
+		int k0 = iq ? -(int)(info->stime_s.samples / 2) : 0;
+		double df = (double)info->stime_s.sps / info->stime_s.samples;
+		s_markers *mk = &info->smarkers[board];
+
+		amp = malloc((2 * info->stime_s.samples) * sizeof(float) +
+			     (2 * info->stime_s.samples) * sizeof(int32_t));
+		if (amp == NULL){
 			syslog(LOG_INFO, "malloc failed (%d)\n",__LINE__);
 			ret = -ENOMEM;
 			goto error_close_file_samples;
 		}
 
+ 		hold = amp + info->stime_s.samples;
+ 		real = (int32_t *)(hold + info->stime_s.samples);
  		imag = real + info->stime_s.samples;
- 		amp = imag + info->stime_s.samples;
 
-		cnt = 0;
-		switch (info->channel_en_mask) {
-		case 1:
-			for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan) {
-				real[cnt] = data[i] - BINARY_OFFSET;
-				imag[cnt] = 0;
-				cnt++;
-			}
-			break;
-		case 2:
-			for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan) {
-				real[cnt] = data[i+1] - BINARY_OFFSET;
-				imag[cnt] = 0;
-				cnt++;
+		if (!info->stime_s.fsamples) {
+			/* FFT over the capture depth, which may be any length */
+			if (cfft_power(amp, nbins, (short *)data, info->stime_s.samples,
+				       samples_per_scan, info->channel_en_mask,
+				       info->sdisplay.window) < 0) {
+				syslog(LOG_INFO, "cfft_power failed (%d)\n",__LINE__);
+				free(amp);
+				ret = -ENOMEM;
+				goto error_close_file_samples;
 			}
-			break;
-		case 3:
-			for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan) {
-				real[cnt] = data[i] - BINARY_OFFSET;
-				imag[cnt] = data[i + 1] - BINARY_OFFSET;
-				cnt++;
+		} else {
+			/* 32 bit block floating point, Q15 samples << 16 */
+			cnt = 0;
+			switch (info->channel_en_mask) {
+			case 1:
+				for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan) {
+					real[cnt] = (data[i] - BINARY_OFFSET) * 65536;
+					imag[cnt] = 0;
+					cnt++;
+				}
+				break;
+			case 2:
+				for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan) {
+					real[cnt] = (data[i+1] - BINARY_OFFSET) * 65536;
+					imag[cnt] = 0;
+					cnt++;
+				}
+				break;
+			case 3:
+				for (i = 0; i < (info->stime_s.samples * samples_per_scan); i+=samples_per_scan) {
+					real[cnt] = (data[i] - BINARY_OFFSET) * 65536;
+					imag[cnt] = (data[i + 1] - BINARY_OFFSET) * 65536;
+					cnt++;
+				}
+					if (info->sdisplay.window)
+						window32(imag, info->stime_s.samples);
+				break;
 			}
-				if (info->sdisplay.window)
-					window(imag, info->stime_s.samples);
-			break;
-		}
 
-		if (info->sdisplay.window)
-			window(real, info->stime_s.samples);
+			if (info->sdisplay.window)
+				window32(real, info->stime_s.samples);
+
+			exponent = fix_fft32 (real, imag, info->stime_s.fsamples, 0);
+			/* same scale as fix_power() of the 1/N scaled fix_fft() */
+			fix_power32 (amp, real, imag, nbins,
+				     exponent - 16 - info->stime_s.fsamples);
+		}
 
-		fix_fft (real, imag, info->stime_s.fsamples, 0);
-		fix_loud (amp, real, imag, info->stime_s.samples/2, 2); /* scale 14->16 bit */
+		if (iq) {
+			if (info->sdisplay.iqbal)
+				iq_imbalance(&info->siq[board], amp, (short *)data,
+					     info->stime_s.samples, samples_per_scan,
+					     info->sdisplay.window);
+			fftshift(amp, nbins);
+		} else {
+			adc_metrics(&info->smetrics[board],
+				    amp, nbins, info->stime_s.samples,
+				    info->sdisplay.window, fix_loud_offset(2));
+		}
+		power_db (amp, amp, nbins, fix_loud_offset(2)); /* scale 14->16 bit */
+		if (info->smarker.n) {
+			/* I/Q harmonics wrap around the rate, DC mid spectrum */
+			marker_find(mk, amp, nbins, iq ? -(int)info->stime_s.samples :
+				    info->stime_s.samples, &info->smarker, k0 * df, df);
+			/* bins as printed, relative to DC */
+			for (i = 0; i < mk->n; i++)
+				mk->peak[i].bin += k0;
+			for (i = 0; i < mk->nharm; i++)
+				mk->harm[i].bin += k0;
+		}
 
-		for (i = info->sdisplay.fftexludezero;
-       			i < (info->stime_s.samples / 2); i++) {
-       				fprintf (file_samples, "%d %d\n", i, amp[i]);
+		if (info->sdisplay.hold)
+			info->hold_count = trace_update(info, device_name, amp, hold,
+							nbins);
+		for (i = 0; i < nbins; i++) {
+			if (info->sdisplay.fftexludezero && i + k0 == 0)
+				continue;
+			text_int(&text, i + k0, ' ');
+			if (info->sdisplay.hold) {
+				text_fixed(&text, amp[i], 2, ' ');
+				text_fixed(&text, hold[i], 2, '\n');
+			} else {
+				text_fixed(&text, amp[i], 2, '\n');
+			}
 		}
 
-		free(real);
+		/* kept for the native plot, freed at exit */
+		free(info->sspectrum[board].db);
+		info->sspectrum[board].db = amp;
+		info->sspectrum[board].hold = info->sdisplay.hold ? hold : NULL;
+		info->sspectrum[board].n = nbins;
+		info->sspectrum[board].k0 = k0;
 	}
 
 error_close_file_samples:
+	text_close(&text);
 	fclose(file_samples);
 
 	ret = 3;
 
+	/* kept for the analyses needing both boards, freed at exit */
+	capture = &info->scapture[board];
+	free(capture->data);
+	capture->data = (short *)data;
+	capture->samples = info->stime_s.samples;
+	capture->samples_per_scan = samples_per_scan;
+	capture->time = tv.tv_sec + tv.tv_usec / 1e6;
+	data = NULL;
+
 error_close_buffer_access:
 	close(fp);
 error_free_data:
@@ -654,7 +779,7 @@ error_free_scan_el_dir_name:
 error_free_buf_dir_name:
 	free(buf_dir_name);
 error_ret:
-	return ret;
+	return ret < 0 ? ret : err;
 }
 
 int iio_test(int form_method, char **getvars, char **postvars, s_info * info,
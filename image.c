@@ -0,0 +1,319 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Raster images rendered by ndso itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+static void put_be32(unsigned char *p, unsigned v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+ * image_palette() - false colour palette for intensity images
+ * @palette:	filled with 256 RGB entries,
+ *		black - blue - cyan - yellow - red - white
+ **/
+void image_palette(unsigned char palette[256][3])
+{
+	static const unsigned char knots[6][3] = {
+		{0, 0, 0}, {0, 0, 255}, {0, 255, 255},
+		{255, 255, 0}, {255, 0, 0}, {255, 255, 255},
+	};
+	int i, c, seg;
+	float t;
+
+	for (i = 0; i < 256; i++) {
+		seg = i * 5 / 256;
+		t = (i * 5 / 256.0f) - seg;
+		for (c = 0; c < 3; c++)
+			palette[i][c] = knots[seg][c] +
+				t * (knots[seg + 1][c] - knots[seg][c]);
+	}
+}
+
+/**
+ * image_write_bmp() - store an RGB image as 24 bit BMP
+ * @filename:	output file
+ * @rgb:	w * h pixels, 3 bytes each, top row first
+ * @w:		width in pixels
+ * @h:		height in pixels
+ *
+ * Returns 0 on success, -1 if the file can't be written.
+ **/
+int image_write_bmp(const char *filename, const unsigned char *rgb,
+		    unsigned w, unsigned h)
+{
+	unsigned char hdr[54], *line;
+	unsigned stride = (w * 3 + 3) & ~3;
+	unsigned x, y;
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+		return -1;
+
+	line = calloc(stride, 1);
+	if (line == NULL) {
+		fclose(fp);
+		return -1;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	hdr[0] = 'B';
+	hdr[1] = 'M';
+	put_le32(hdr + 2, sizeof(hdr) + stride * h);
+	put_le32(hdr + 10, sizeof(hdr));
+	put_le32(hdr + 14, 40);
+	put_le32(hdr + 18, w);
+	put_le32(hdr + 22, h);
+	put_le16(hdr + 26, 1);
+	put_le16(hdr + 28, 24);
+	put_le32(hdr + 34, stride * h);
+	fwrite(hdr, sizeof(hdr), 1, fp);
+
+	/* BMP rows are bottom up and BGR */
+	for (y = h; y-- > 0;) {
+		const unsigned char *p = rgb + y * w * 3;
+
+		for (x = 0; x < w; x++, p += 3) {
+			line[x * 3] = p[2];
+			line[x * 3 + 1] = p[1];
+			line[x * 3 + 2] = p[0];
+		}
+		fwrite(line, stride, 1, fp);
+	}
+
+	free(line);
+	fclose(fp);
+
+	return 0;
+}
+
+/* ------------ PNG ------------ */
+
+struct bits {
+	unsigned char *p;
+	uint32_t acc;
+	unsigned n;
+};
+
+/* deflate packs bits LSB first */
+static void put_bits(struct bits *b, unsigned v, unsigned n)
+{
+	b->acc |= v << b->n;
+	b->n += n;
+	while (b->n >= 8) {
+		*b->p++ = b->acc;
+		b->acc >>= 8;
+		b->n -= 8;
+	}
+}
+
+/* Huffman codes go MSB first, so they are stored reversed */
+static void put_code(struct bits *b, unsigned code, unsigned n)
+{
+	unsigned r = 0, i;
+
+	for (i = 0; i < n; i++, code >>= 1)
+		r = (r << 1) | (code & 1);
+	put_bits(b, r, n);
+}
+
+/* symbol of the fixed literal/length code, RFC 1951 3.2.6 */
+static void put_symbol(struct bits *b, unsigned sym)
+{
+	if (sym < 144)
+		put_code(b, 0x30 + sym, 8);
+	else if (sym < 256)
+		put_code(b, 0x190 + sym - 144, 9);
+	else if (sym < 280)
+		put_code(b, sym - 256, 7);
+	else
+		put_code(b, 0xc0 + sym - 280, 8);
+}
+
+/*
+ * A single fixed Huffman block, where the only matches are runs of the
+ * previous byte (distance 1). Plots are mostly background, so that is
+ * where nearly all of the gain is, at a fraction of the cost of a
+ * match search. Returns the length written to out, which must hold
+ * len * 9 / 8 + 16 bytes.
+ */
+static unsigned deflate_rle(unsigned char *out, const unsigned char *in,
+			    unsigned len)
+{
+	static const unsigned short base[29] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+	};
+	static const unsigned char extra[29] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+	};
+	struct bits b = { out, 0, 0 };
+	unsigned i = 0, run, j;
+
+	put_bits(&b, 1, 1);	/* final */
+	put_bits(&b, 1, 2);	/* fixed Huffman */
+
+	while (i < len) {
+		run = 0;
+		if (i > 0)
+			while (run < 258 && i + run < len &&
+			       in[i + run] == in[i - 1])
+				run++;
+
+		if (run < 3) {
+			put_symbol(&b, in[i++]);
+			continue;
+		}
+
+		for (j = 28; base[j] > run; j--)
+			;
+		put_symbol(&b, 257 + j);
+		put_bits(&b, run - base[j], extra[j]);
+		put_code(&b, 0, 5);	/* distance 1 */
+		i += run;
+	}
+
+	put_symbol(&b, 256);
+	if (b.n)
+		put_bits(&b, 0, 8 - b.n);
+
+	return b.p - out;
+}
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char *p, unsigned len)
+{
+	static uint32_t table[256];
+	uint32_t c;
+	unsigned i, k;
+
+	if (table[1] == 0)
+		for (i = 0; i < 256; i++) {
+			for (c = i, k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static uint32_t adler32(const unsigned char *p, unsigned len)
+{
+	uint32_t a = 1, b = 0;
+	unsigned n;
+
+	while (len) {
+		/* no overflow of b within 5552 bytes */
+		n = len < 5552 ? len : 5552;
+		len -= n;
+		while (n--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+static void png_chunk(FILE * fp, const char *type, const unsigned char *data,
+		      unsigned len)
+{
+	unsigned char hdr[8];
+	uint32_t crc;
+
+	put_be32(hdr, len);
+	memcpy(hdr + 4, type, 4);
+	crc = crc32_update(0, hdr + 4, 4);
+	crc = crc32_update(crc, data, len);
+
+	fwrite(hdr, 8, 1, fp);
+	if (len)
+		fwrite(data, len, 1, fp);
+	put_be32(hdr, crc);
+	fwrite(hdr, 4, 1, fp);
+}
+
+/**
+ * image_write_png() - store a palette image as 8 bit PNG
+ * @filename:	output file
+ * @pix:	w * h palette indices, top row first
+ * @w:		width in pixels
+ * @h:		height in pixels
+ * @palette:	RGB entries
+ * @ncolors:	number of entries in @palette, at most 256
+ *
+ * Returns 0 on success, -1 if the file can't be written.
+ **/
+int image_write_png(const char *filename, const unsigned char *pix,
+		    unsigned w, unsigned h, const unsigned char palette[][3],
+		    unsigned ncolors)
+{
+	static const unsigned char sig[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+	};
+	unsigned char ihdr[13], *raw, *z;
+	unsigned len = (w + 1) * h, zlen, y;
+	FILE *fp;
+
+	raw = malloc(len + len + len / 8 + 32);
+	if (raw == NULL)
+		return -1;
+	z = raw + len;
+
+	/* filter type 0 (none) in front of every row */
+	for (y = 0; y < h; y++) {
+		raw[y * (w + 1)] = 0;
+		memcpy(raw + y * (w + 1) + 1, pix + y * w, w);
+	}
+
+	z[0] = 0x78;		/* deflate, 32K window */
+	z[1] = 0x01;
+	zlen = 2 + deflate_rle(z + 2, raw, len);
+	put_be32(z + zlen, adler32(raw, len));
+	zlen += 4;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL) {
+		free(raw);
+		return -1;
+	}
+
+	put_be32(ihdr, w);
+	put_be32(ihdr + 4, h);
+	ihdr[8] = 8;		/* bit depth */
+	ihdr[9] = 3;		/* palette */
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	fwrite(sig, sizeof(sig), 1, fp);
+	png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+	png_chunk(fp, "PLTE", palette[0], ncolors * 3);
+	png_chunk(fp, "IDAT", z, zlen);
+	png_chunk(fp, "IEND", NULL, 0);
+
+	free(raw);
+	fclose(fp);
+
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Spectrum markers: the strongest peaks above a threshold, with
+ * frequency and level interpolated between bins, and the harmonics
+ * of the strongest one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+/*
+ * Parabola through the dB values of a bin and its neighbours. On a dB
+ * scale the window main lobe is close to a parabola, which makes this
+ * as accurate as Jacobsen's estimator without the complex bins; the
+ * spectra here are power only.
+ */
+static void marker_interpolate(s_marker * m, const float *db, int k,
+			       int nbins, double f0, double df)
+{
+	float a, b = db[k], c, d = 0;
+
+	if (k > 0 && k < nbins - 1) {
+		a = db[k - 1];
+		c = db[k + 1];
+		if (a - 2 * b + c < 0)
+			d = 0.5f * (a - c) / (a - 2 * b + c);
+		b -= 0.25f * (a - c) * d;
+	}
+
+	m->bin = k + d;
+	m->freq = f0 + m->bin * df;
+	m->db = b;
+}
+
+/* strongest bin within +-MARKER_SEARCH of k */
+static int marker_local_max(const float *db, int k, int nbins)
+{
+	int i, lo = k - MARKER_SEARCH, hi = k + MARKER_SEARCH, best = k;
+
+	if (lo < 1)
+		lo = 1;
+	if (hi > nbins - 2)
+		hi = nbins - 2;
+
+	for (i = lo; i <= hi; i++)
+		if (db[i] > db[best])
+			best = i;
+
+	return best;
+}
+
+/**
+ * marker_find() - peak and harmonic markers of a spectrum
+ * @mk:		results
+ * @db:		spectrum in dB
+ * @nbins:	number of bins in @db
+ * @fold:	FFT size of a real spectrum from DC, harmonics above half
+ *		the rate fold back like aliases of a real signal; minus
+ *		the FFT size of a complex spectrum of the whole rate, where
+ *		they wrap around it; 0 for a span, where harmonics outside
+ *		it are not reported
+ * @set:	number of markers and threshold
+ * @f0:		frequency of bin 0
+ * @df:		bin spacing
+ *
+ * Markers are sorted by level, the first one is the reference of the
+ * delta readout and the fundamental of the harmonics. Harmonics are
+ * looked for at multiples of the fundamental's frequency, not of its
+ * bin, so spectra not starting at DC get them right too.
+ * Returns the number of peaks found.
+ **/
+int marker_find(s_markers * mk, const float *db, int nbins, int fold,
+		const marker_set * set, double f0, double df)
+{
+	unsigned char *flag;
+	int i, j, k, n = 0, top[MARKER_MAX], max = set->n;
+	double h0, fs = abs(fold) * df;
+
+	memset(mk, 0, sizeof(*mk));
+
+	if (max > MARKER_MAX)
+		max = MARKER_MAX;
+	if (max <= 0 || nbins < 3)
+		return 0;
+
+	flag = malloc(nbins);
+	if (flag == NULL)
+		return -ENOMEM;
+
+	/* branch free, so this pass over all bins vectorizes */
+	flag[0] = flag[nbins - 1] = 0;
+	for (i = 1; i < nbins - 1; i++)
+		flag[i] = (db[i] > db[i - 1]) & (db[i] >= db[i + 1]) &
+			  (db[i] > set->threshold);
+
+	/* partial sort, only the best max peaks are kept in order */
+	for (i = 1; i < nbins - 1; i++) {
+		if (!flag[i])
+			continue;
+		if (n == max && db[i] <= db[top[n - 1]])
+			continue;
+		j = (n < max) ? n++ : n - 1;
+		for (; j > 0 && db[top[j - 1]] < db[i]; j--)
+			top[j] = top[j - 1];
+		top[j] = i;
+	}
+
+	free(flag);
+
+	for (i = 0; i < n; i++)
+		marker_interpolate(&mk->peak[i], db, top[i], nbins, f0, df);
+	mk->n = n;
+
+	/* without a bin spacing there is no frequency to place them at */
+	if (n == 0 || df <= 0)
+		return n;
+
+	/* harmonics of the fundamental, measured at their own peak */
+	h0 = mk->peak[0].freq;
+	for (i = 0; i < MARKER_HARMONICS; i++) {
+		double h = h0 * (i + 2);
+
+		if (fold > 0) {
+			h = fmod(h, fs);
+			if (h > fs / 2)
+				h = fs - h;
+		} else if (fold < 0) {
+			h = fmod(h - f0, fs);
+			h += (h < 0) ? f0 + fs : f0;
+		}
+
+		k = lrint((h - f0) / df);
+		if (k < 1 || k >= nbins - 1)
+			break;
+
+		k = marker_local_max(db, k, nbins);
+		marker_interpolate(&mk->harm[i], db, k, nbins, f0, df);
+		mk->harm[i].db -= mk->peak[0].db;
+		mk->nharm = i + 1;
+	}
+
+	return n;
+}
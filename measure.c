@@ -0,0 +1,294 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Measurements on captured spectra.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+/* smallest power used in ratios, keeps log10() finite */
+#define METRICS_MIN_POWER	1e-30f
+
+struct span {
+	int lo;
+	int hi;
+};
+
+static float span_power(const float *pwr, int lo, int hi)
+{
+	float sum = 0;
+	int k;
+
+	for (k = lo; k <= hi; k++)
+		sum += pwr[k];
+
+	return sum;
+}
+
+static int span_overlaps(const struct span *s, int n, int lo, int hi)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (lo <= s[i].hi && hi >= s[i].lo)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Widen [k - leak, k + leak] for as long as the bins keep falling away
+ * from the peak, so the skirt of a non-coherently sampled tone is not
+ * counted as noise. Clipped to lo .. hi.
+ */
+static void span_skirt(struct span *s, const float *pwr, int k, int leak,
+		       int lo, int hi)
+{
+	int max = leak + (hi - lo) / 16;
+	int a = k, b = k;
+
+	while (a > lo && (k - a < leak || (k - a < max && pwr[a - 1] < pwr[a])))
+		a--;
+	while (b < hi && (b - k < leak || (b - k < max && pwr[b + 1] < pwr[b])))
+		b++;
+
+	s->lo = a;
+	s->hi = b;
+}
+
+static int span_cmp(const void *a, const void *b)
+{
+	return ((const struct span *)a)->lo - ((const struct span *)b)->lo;
+}
+
+static float ratio_db(float num, float den)
+{
+	if (num < METRICS_MIN_POWER)
+		num = METRICS_MIN_POWER;
+	if (den < METRICS_MIN_POWER)
+		den = METRICS_MIN_POWER;
+
+	return 10 * log10f(num / den);
+}
+
+/**
+ * adc_metrics() - dynamic performance figures of a single tone capture
+ * @m:		where the results are stored
+ * @pwr:	power spectrum (magnitude squared), bins 0 .. nbins - 1
+ * @nbins:	number of bins in @pwr, fft_size / 2
+ * @fft_size:	FFT length the spectrum was computed with
+ * @windowed:	the capture was Hanning windowed before the FFT
+ * @offset:	dB offset that makes 10 * log10(pwr[k]) read in dBFS
+ *
+ * The fundamental is the largest bin above DC. Its power, and that of
+ * harmonics 2 .. METRICS_HARMONICS aliased back into the first Nyquist
+ * zone, is summed over the window's main lobe. Everything else but DC
+ * is noise; bins hidden under DC, the fundamental and the harmonics are
+ * credited with the average noise power per bin.
+ *
+ * Returns 0 on success, -1 if the spectrum is too short to hold a tone.
+ **/
+int adc_metrics(s_metrics *m, const float *pwr, int nbins, int fft_size,
+		int windowed, float offset)
+{
+	struct span used[2 + METRICS_HARMONICS];
+	int leak = windowed ? 3 : 1;
+	/* mean square of the window, sum of w^2 / N (Hann: 3/8) */
+	float wpower = windowed ? 0.375f : 1.0f;
+	float fund, harm, noise, spur, fbin, sum, p;
+	int nused, noise_bins, k, k0, h, lo, hi;
+
+	memset(m, 0, sizeof(*m));
+
+	if (nbins <= 2 * leak + 2)
+		return -1;
+
+	/* DC and its leakage */
+	span_skirt(&used[0], pwr, 0, leak, 0, nbins - 1);
+
+	/* fundamental */
+	k0 = used[0].hi + 1;
+	for (k = k0 + 1; k < nbins; k++)
+		if (pwr[k] > pwr[k0])
+			k0 = k;
+
+	span_skirt(&used[1], pwr, k0, leak, used[0].hi + 1, nbins - 1);
+	nused = 2;
+
+	for (k = used[1].lo, sum = 0; k <= used[1].hi; k++)
+		sum += pwr[k] * k;
+	fund = span_power(pwr, used[1].lo, used[1].hi);
+	fbin = fund > 0 ? sum / fund : k0;
+
+	/* harmonics, folded into 0 .. fft_size / 2 */
+	harm = 0;
+	for (h = 2; h <= METRICS_HARMONICS; h++) {
+		float f = fmodf(fbin * h, fft_size);
+		int kh;
+
+		if (f > fft_size / 2)
+			f = fft_size - f;
+		kh = (int)(f + 0.5f);
+
+		/* the peak may sit one bin off the computed position */
+		if (kh > 0 && kh < nbins && pwr[kh - 1] > pwr[kh])
+			kh--;
+		else if (kh + 1 < nbins && pwr[kh + 1] > pwr[kh])
+			kh++;
+
+		/* harm_bin 0 marks a harmonic hidden under DC or a tone */
+		if (kh >= nbins ||
+		    span_overlaps(used, nused, kh - leak, kh + leak))
+			continue;
+
+		span_skirt(&used[nused], pwr, kh, leak, 0, nbins - 1);
+		/* don't let the skirt run into another component */
+		if (span_overlaps(used, nused, used[nused].lo, used[nused].hi)) {
+			used[nused].lo = kh - leak;
+			used[nused].hi = kh + leak < nbins - 1 ? kh + leak : nbins - 1;
+		}
+
+		p = span_power(pwr, used[nused].lo, used[nused].hi);
+		m->harm_bin[h - 2] = kh;
+		m->harm_dbc[h - 2] = ratio_db(p, fund);
+		harm += p;
+		nused++;
+	}
+
+	/* largest spur, excluding DC and fundamental */
+	spur = 0;
+	m->spur_bin = 0;
+	for (k = used[0].hi + 1; k < nbins; k++)
+		if ((k < used[1].lo || k > used[1].hi) && pwr[k] > spur) {
+			spur = pwr[k];
+			m->spur_bin = k;
+		}
+
+	/*
+	 * Noise is summed over the gaps between the used spans rather than
+	 * taken as total - fund - harm, which would cancel in float.
+	 */
+	qsort(used, nused, sizeof(used[0]), span_cmp);
+	noise = 0;
+	noise_bins = 0;
+	for (k = 0; k < nused; k++) {
+		lo = used[k].hi + 1;
+		hi = (k + 1 < nused) ? used[k + 1].lo - 1 : nbins - 1;
+		if (hi >= lo) {
+			noise += span_power(pwr, lo, hi);
+			noise_bins += hi - lo + 1;
+		}
+	}
+	if (noise_bins > 0)
+		noise *= (float)(nbins - (used[0].hi + 1)) / noise_bins;
+
+	m->fund_bin = fbin;
+	m->fund_dbfs = ratio_db(fund, wpower) + offset;
+	m->snr = ratio_db(fund, noise);
+	m->sinad = ratio_db(fund, noise + harm);
+	m->thd = ratio_db(harm, fund);
+	m->sfdr = ratio_db(pwr[k0], spur);
+	m->enob = (m->sinad - 1.76f) / 6.02f;
+
+	m->snr_fs = m->snr - m->fund_dbfs;
+	m->sinad_fs = m->sinad - m->fund_dbfs;
+	m->thd_fs = m->thd + m->fund_dbfs;
+	m->sfdr_fs = m->sfdr - m->fund_dbfs;
+	m->enob_fs = (m->sinad_fs - 1.76f) / 6.02f;
+	m->valid = 1;
+
+	return 0;
+}
+
+/*
+ * Single bin DFT of the I and Q parts, windowed like the spectrum.
+ * The phasor is rotated in double, n steps lose far less than the
+ * spectrum resolves.
+ */
+static void iq_bin(double *ir, double *ii, double *qr, double *qi,
+		   const short *data, unsigned n, unsigned samples_per_scan,
+		   int k, int windowed)
+{
+	double c = cos(2 * M_PI * k / n), s = -sin(2 * M_PI * k / n);
+	double pr = 1, pi = 0, t, w = 1, vi, vq;
+	unsigned i;
+
+	*ir = *ii = *qr = *qi = 0;
+
+	for (i = 0; i < n; i++) {
+		if (windowed)
+			w = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+		vi = w * data[i * samples_per_scan];
+		vq = w * data[i * samples_per_scan + 1];
+		*ir += vi * pr;
+		*ii += vi * pi;
+		*qr += vq * pr;
+		*qi += vq * pi;
+		t = pr * c - pi * s;
+		pi = pr * s + pi * c;
+		pr = t;
+	}
+}
+
+/**
+ * iq_imbalance() - gain and phase imbalance of an I/Q capture
+ * @iq:		results
+ * @pwr:	power spectrum of ch0 + j ch1, n bins, DC first
+ * @data:	the capture, I in ch0 and Q in ch1
+ * @n:		samples, the FFT length of @pwr
+ * @samples_per_scan: values per sample in @data
+ * @windowed:	@pwr was computed with a Hanning window
+ *
+ * The strongest tone away from DC and its mirror image at the negative
+ * frequency give the image rejection. Its I and Q components, from
+ * the mirror bins X(k) and X(-k), give the gain of Q relative to I and
+ * the deviation of their phase from 90 degrees, with the same sign for
+ * tones above and below DC.
+ *
+ * Returns 0 on success, -EINVAL if there is no tone.
+ **/
+int iq_imbalance(s_iq * iq, const float *pwr, const short *data, unsigned n,
+		 unsigned samples_per_scan, int windowed)
+{
+	double ir, ii, qr, qi, d, gr, gi;
+	unsigned k, peak = 0;
+
+	memset(iq, 0, sizeof(*iq));
+
+	if (n < 8 || samples_per_scan < 2)
+		return -EINVAL;
+
+	/* DC and its window leakage are no tone */
+	for (k = 2; k < n - 1; k++)
+		if (!peak || pwr[k] > pwr[peak])
+			peak = k;
+
+	iq_bin(&ir, &ii, &qr, &qi, data, n, samples_per_scan, peak, windowed);
+
+	d = ir * ir + ii * ii;
+	if (d <= 0 || pwr[peak] <= 0)
+		return -EINVAL;
+
+	/* Q / I, -j for a perfect quadrature pair */
+	gr = (qr * ir + qi * ii) / d;
+	gi = (qi * ir - qr * ii) / d;
+
+	iq->bin = peak < n / 2 ? (int)peak : (int)peak - (int)n;
+	iq->irr = 10 * log10(pwr[peak] / fmax(pwr[n - peak], METRICS_MIN_POWER));
+	iq->gain = 10 * log10(gr * gr + gi * gi);
+	iq->phase = atan2(gi, gr) * (180 / M_PI) + 90;
+	if (iq->phase > 180)
+		iq->phase -= 360;
+	iq->valid = 1;
+
+	return 0;
+}
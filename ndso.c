@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <syslog.h>
+#include <errno.h>
 
 #ifdef TM_IN_SYS_TIME
 #include <sys/time.h>
@@ -180,6 +181,18 @@ void make_session_files(s_info * info)
 	    strdup(strcat(strcpy(str, FILENAME_T_OUT2), info->pREMOTE_ADDR));
 	info->pFILENAME_GNUPLT =
 	    strdup(strcat(strcpy(str, FILENAME_GNUPLT), info->pREMOTE_ADDR));
+	info->pFILENAME_WF =
+	    strdup(strcat(strcpy(str, FILENAME_WF), info->pREMOTE_ADDR));
+	info->pFILENAME_WF_IMG =
+	    strdup(strcat(strcat(strcpy(str, FILENAME_WF_IMG), info->pREMOTE_ADDR), ".bmp"));
+	info->pFILENAME_PE =
+	    strdup(strcat(strcpy(str, FILENAME_PE), info->pREMOTE_ADDR));
+	info->pFILENAME_PE_IMG =
+	    strdup(strcat(strcat(strcpy(str, FILENAME_PE_IMG), info->pREMOTE_ADDR), ".bmp"));
+	info->pFILENAME_IMG =
+	    strdup(strcat(strcat(strcpy(str, FILENAME_IMG), info->pREMOTE_ADDR), ".png"));
+	info->pFILENAME_SAVE =
+	    strdup(strcat(strcpy(str, FILENAME_SAVE), info->pREMOTE_ADDR));
 
 	return;
 };
@@ -190,7 +203,18 @@ void free_session_files(s_info * info)
 	free(info->pFILENAME_T_OUT);
 	free(info->pFILENAME_T_OUT2);
 	free(info->pFILENAME_GNUPLT);
+	free(info->pFILENAME_WF);
+	free(info->pFILENAME_WF_IMG);
+	free(info->pFILENAME_PE);
+	free(info->pFILENAME_PE_IMG);
+	free(info->pFILENAME_IMG);
+	free(info->pFILENAME_SAVE);
 	free(info->pGNUPLOT);
+	free(info->scapture[0].data);
+	free(info->scapture[1].data);
+	free(info->sspectrum[0].db);
+	free(info->sspectrum[1].db);
+	free(info->sfilter.taps);
 
 	return;
 };
@@ -233,11 +257,109 @@ void do_files(s_info * info)
 	return;
 };
 
+void do_metrics(s_info * info, s_metrics * m, char *name)
+{
+	int h;
+
+	if (!m->valid)
+		return;
+
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sFund:  %.0f Hz %4.2f dBFS</font></p>\n",
+		name, m->fund_bin * info->stime_s.sps / info->stime_s.samples, m->fund_dbfs);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sSNR:   %4.2f dBc %4.2f dBFS</font></p>\n",
+		name, m->snr, m->snr_fs);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sSINAD: %4.2f dBc %4.2f dBFS</font></p>\n",
+		name, m->sinad, m->sinad_fs);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sSFDR:  %4.2f dBc %4.2f dBFS</font></p>\n",
+		name, m->sfdr, m->sfdr_fs);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sTHD:   %4.2f dBc %4.2f dBFS</font></p>\n",
+		name, m->thd, m->thd_fs);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sENOB:  %4.2f bits (%4.2f FS)</font></p>\n",
+		name, m->enob, m->enob_fs);
+	for (h = 0; h < METRICS_HARMONICS - 1; h++)
+		if (m->harm_bin[h])
+			printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sHD%d:   %4.2f dBc @ %u</font></p>\n",
+				name, h + 2, m->harm_dbc[h], m->harm_bin[h]);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> ______________</font></p>\n");
+}
+
+void do_iq(s_info * info, s_iq * iq, char *name)
+{
+	if (!iq->valid)
+		return;
+
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sTone:  %.0f Hz Image %4.2f dBc</font></p>\n",
+		name, (double)iq->bin * info->stime_s.sps / info->stime_s.samples, -iq->irr);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sQ/I:   %4.3f dB %4.2f deg</font></p>\n",
+		name, iq->gain, iq->phase);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> ______________</font></p>\n");
+}
+
+void do_markers(s_info * info, s_markers * mk, char *name)
+{
+	s_marker *m;
+	unsigned i;
+
+	if (!mk->n)
+		return;
+
+	for (i = 0; i < mk->n; i++) {
+		m = &mk->peak[i];
+		if (i == 0)
+			printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sM1: %.3f Hz %4.2f dB</font></p>\n",
+				name, m->freq, m->db);
+		else
+			printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sM%u: %.3f Hz %4.2f dB (D %.3f Hz %4.2f dB)</font></p>\n",
+				name, i + 1, m->freq, m->db,
+				m->freq - mk->peak[0].freq, m->db - mk->peak[0].db);
+	}
+	for (i = 0; i < mk->nharm; i++)
+		printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %sH%u: %.3f Hz %4.2f dBc</font></p>\n",
+			name, i + 2, mk->harm[i].freq, mk->harm[i].db);
+	printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> ______________</font></p>\n");
+}
+
+/*
+ * Acquire Save, from the session's copy of the capture file, see
+ * save_store(). Without resume, the capture just made is stored first
+ * and goes out whole; with it, the stored copy serves the range asked
+ * for, so a resumed download continues the same capture.
+ *
+ * Returns -ENOENT if there is no copy to resume.
+ */
+static int do_save(int form_method, char **getvars, char **postvars,
+		   s_info * info, int resume)
+{
+	static const char *ext[] = { "bin", "txt", "sigmf" };
+	unsigned fmt = info->sdisplay.save_fmt;
+	char path[128], name[80];
+	int ret;
+
+	snprintf(path, sizeof(path), "%s.%s", info->pFILENAME_SAVE, ext[fmt]);
+	snprintf(name, sizeof(name), "%s_%s.%s",
+		 fmt == SAVE_TEXT ? "samples" : "capture", info->pREMOTE_ADDR,
+		 ext[fmt]);
+
+	if (!resume) {
+		ret = save_store(info, path, postvars[info->sinput.device],
+				 (info->sinput.slaveadc == 0xFFFF) ?
+				 NULL : postvars[info->sinput.slaveadc]);
+		if (ret < 0)
+			do_error(ret == -EINVAL ? NO_CAPTURE : FILE_OPEN,
+				 form_method, getvars, postvars, info);
+	}
+
+	/* nothing is sent if it doesn't open */
+	ret = download_file(path, name, resume);
+	if (ret == -ENOENT && !resume)
+		do_error(FILE_OPEN, form_method, getvars, postvars, info);
+
+	return ret;
+}
+
 int do_html(int form_method, char **getvars, char **postvars, s_info * info)
 {
-	int fd, n = 0;
-	unsigned val;
-	char buf[256];
+	unsigned val, p;
 
 	switch (info->run) {
 	case ACQUIRE:
@@ -259,22 +381,43 @@ int do_html(int form_method, char **getvars, char **postvars, s_info * info)
 				printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> CH1 Max:%d</font></p>\n", info->max_ch1);
 				printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> CH1 Avg:%4.3f</font></p>\n", info->avg_ch1);
 			}
+			if (info->sdisplay.persist && info->spersist.count) {
+				printf("\n<br clear=\"all\"><img border=\"0\" src=\"/pe%s.bmp?id=%u\" align=\"left\">\n",
+				       info->pREMOTE_ADDR, getrand());
+				printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> Persistence: %u captures, %.2f samples/period</font></p>\n",
+				       info->spersist.count, info->spersist.period);
+			}
+		} else {
+			if (info->sdisplay.waterfall && !info->sdisplay.zoom)
+				printf("\n<br clear=\"all\"><img border=\"0\" src=\"/wf%s.bmp?id=%u\" align=\"left\">\n",
+				       info->pREMOTE_ADDR, getrand());
+			if (info->sdisplay.hold && info->hold_count > 0)
+				printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %s: %d spectra</font></p>\n",
+				       trace_name(info), info->hold_count);
+			for (p = 0; info->sdisplay.cross && p < info->scross.npairs; p++)
+				printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %s @ %.0f Hz: Coh %.4f Phase %4.2f deg Gain %4.2f dB</font></p>\n",
+				       info->scross.pair[p].name, info->scross.pair[p].freq,
+				       info->scross.pair[p].coherence, info->scross.pair[p].phase,
+				       info->scross.pair[p].gain);
+			do_markers(info, &info->smarkers[0], info->has_slave ? "LPC " : "");
+			if (info->has_slave)
+				do_markers(info, &info->smarkers[1], "HPC ");
+			do_metrics(info, &info->smetrics[0], info->has_slave ? "LPC " : "");
+			if (info->has_slave)
+				do_metrics(info, &info->smetrics[1], "HPC ");
+			do_iq(info, &info->siq[0], info->has_slave ? "LPC " : "");
+			if (info->has_slave)
+				do_iq(info, &info->siq[1], "HPC ");
 		}
+		if (info->scorr.valid)
+			printf("<p style=\"margin-top: 0; margin-bottom: 0\"><font face=\"Courier new\"> %s Delay: %.3f samples (%.3f ns) Corr %.4f</font></p>\n",
+			       info->has_slave ? "HPC-LPC" : "CH1-CH0", info->scorr.delay,
+			       info->stime_s.sps ? info->scorr.delay * 1e9 / info->stime_s.sps : 0,
+			       info->scorr.quality);
 		htmlFooter();
 		break;
 	case SAVE:
-		fd = open(info->pFILENAME_T_OUT, 0);
-		if (fd < 0)
-			break;
-
-		printf("Content-type: application/octet-stream\n");
-		printf("Content-Transfer-Encoding: binary\n");
-		printf("Content-Disposition: attachment; filename=\"samples_%s.txt\"\n\n", info->pREMOTE_ADDR);
-		do {
-			fwrite(buf, n, 1, stdout);
-			n = read(fd, buf, 256);
-		} while(n!=0);
-		close(fd);
+		do_save(form_method, getvars, postvars, info, 0);
 		break;
 	case SHOWDEVATTR:
 	case WSYSFS:
@@ -316,6 +459,15 @@ int do_html(int form_method, char **getvars, char **postvars, s_info * info)
 		do_test(form_method, getvars, postvars, info);
 		htmlFooter();
 		break;
+	case TONE:
+		printf("Content-type: text/plain\n\n");
+		if (tone_report(info, stdout) < 0)
+			printf("# no tones, sample rate or capture\n");
+		break;
+	case DATA:
+		if (data_send(info, stdout) < 0)
+			printf("Content-type: text/plain\n\nno capture\n");
+		break;
 	default:
 
 		break;
@@ -390,6 +542,28 @@ int do_error(int errnum, int form_method, char **getvars, char **postvars,
 		    ("<p><font face=\"Tahoma\" size=\"7\">Ratio between Sample Depth and Sample Rate will exceed Timeout criteria [%d sec].\n</font></p>",
 		     TIMEOUT);
 		break;
+	case CHANNELS:
+		printf
+		    ("<p><font face=\"Tahoma\" size=\"7\">ERROR[%d]:\n</font></p>",
+		     CHANNELS);
+		printf
+		    ("<p><font face=\"Tahoma\" size=\"7\">Cross Spectrum needs both channels enabled or a Slave ADC, I/Q Baseband both channels.\n</font></p>");
+		break;
+	case COEF_FILE:
+		printf
+		    ("<p><font face=\"Tahoma\" size=\"7\">ERROR[%d]:\n</font></p>",
+		     COEF_FILE);
+		printf
+		    ("<p><font face=\"Tahoma\" size=\"7\">Can't read filter coefficients from %s.\n</font></p>",
+		     FILENAME_COEF);
+		break;
+	case NO_CAPTURE:
+		printf
+		    ("<p><font face=\"Tahoma\" size=\"7\">ERROR[%d]:\n</font></p>",
+		     NO_CAPTURE);
+		printf
+		    ("<p><font face=\"Tahoma\" size=\"7\">Nothing was captured to save.\n</font></p>");
+		break;
 	default:
 		printf
 		    ("<p><font face=\"Tahoma\" size=\"7\">ERROR[UNDEF]:\n</font></p>");
@@ -498,6 +672,55 @@ int parse_request(int form_method, char **getvars, char **postvars, s_info * inf
 	      			info->stime_s.fsamples = str2num (postvars[i + 1]);
 	    		} else if (strncmp (postvars[i], "C8", 2) == 0) {
 	    			info->sdisplay.fftscaled = 1;
+			} else if (strncmp(postvars[i], "IQ", 2) == 0) {
+				info->sdisplay.iq = 1;
+			} else if (strncmp(postvars[i], "IB", 2) == 0) {
+				info->sdisplay.iqbal = 1;
+			} else if (strncmp(postvars[i], "SF", 2) == 0) {
+				info->sdisplay.save_fmt = str2num(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "GP", 2) == 0) {
+				info->sdisplay.gnuplot = 1;
+			} else if (strncmp(postvars[i], "ZM", 2) == 0) {
+				info->sdisplay.zoom = 1;
+			} else if (strncmp(postvars[i], "ZC", 2) == 0) {
+				info->szoom.centre = atof(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "ZS", 2) == 0) {
+				info->szoom.span = atof(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "TM", 2) == 0) {
+				info->sdisplay.hold = str2num(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "TA", 2) == 0) {
+				info->sdisplay.holdavg = str2num(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "TR", 2) == 0) {
+				info->sdisplay.holdreset = 1;
+			} else if (strncmp(postvars[i], "WF", 2) == 0) {
+				info->sdisplay.waterfall = 1;
+			} else if (strncmp(postvars[i], "WC", 2) == 0) {
+				info->sdisplay.wfclear = 1;
+			} else if (strncmp(postvars[i], "XS", 2) == 0) {
+				info->sdisplay.cross = 1;
+			} else if (strncmp(postvars[i], "PE", 2) == 0) {
+				info->sdisplay.persist = 1;
+			} else if (strncmp(postvars[i], "PP", 2) == 0) {
+				info->spersist.period = atof(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "PD", 2) == 0) {
+				info->spersist.decay = str2num(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "PC", 2) == 0) {
+				info->spersist.clear = 1;
+			} else if (strncmp(postvars[i], "XC", 2) == 0) {
+				info->sdisplay.corr = 1;
+			} else if (strncmp(postvars[i], "XA", 2) == 0) {
+				info->sdisplay.corr = 1;
+				info->sdisplay.align = 1;
+			} else if (strncmp(postvars[i], "MK", 2) == 0) {
+				info->smarker.n = str2num(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "MT", 2) == 0) {
+				info->smarker.threshold = atof(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "GF", 2) == 0) {
+				tone_parse(info, postvars[i + 1]);
+			} else if (strncmp(postvars[i], "FL", 2) == 0) {
+				info->sfilter.type = str2num(postvars[i + 1]);
+			} else if (strncmp(postvars[i], "FK", 2) == 0) {
+				info->sfilter.coef = i + 1;
 			} else if (strncmp(postvars[i], "B1", 2) == 0) {
 				info->run = ACQUIRE;
 			} else if (strncmp(postvars[i], "B3", 2) == 0) {
@@ -514,6 +737,16 @@ int parse_request(int form_method, char **getvars, char **postvars, s_info * inf
 				info->run = WSYSFS;
 			} else if (strncmp(postvars[i], "B8", 2) == 0) {
 				info->run = TEST;
+			} else if (strncmp(postvars[i], "BT", 2) == 0) {
+				info->run = TONE;
+			} else if (strncmp(postvars[i], "BD", 2) == 0) {
+				info->run = DATA;
+			} else if (strncmp(postvars[i], "BL", 2) == 0) {
+				info->run = LIVE;
+			} else if (strncmp(postvars[i], "BM", 2) == 0) {
+				info->run = MEASURE;
+			} else if (strncmp(postvars[i], "LR", 2) == 0) {
+				info->sdisplay.live_fps = str2num(postvars[i + 1]);
 			} else if (strncmp(postvars[i], "FB", 2) == 0) {
 				info->framebuffer = str2num(postvars[i + 1]);
 			} else if (strncmp(postvars[i], "__", 2) == 0) {
@@ -547,9 +780,6 @@ int parse_request(int form_method, char **getvars, char **postvars, s_info * inf
 	else
 		info->id = 0;
 
-	if (!info->sdisplay.tdom)
-		info->stime_s.samples = 1 << info->stime_s.fsamples;
-
 	return 0;
 };
 
@@ -558,14 +788,58 @@ int check_request(int form_method, char **getvars, char **postvars, s_info * inf
 	if ((info->sinput.slaveadc != 0xFFFF) &&
 		(strcmp(postvars[info->sinput.device],
 			postvars[info->sinput.slaveadc]) == 0) &&
-			(info->run == ACQUIRE || info->run == SAVE))
+			(info->run == ACQUIRE || info->run == SAVE ||
+			 info->run == TONE || info->run == DATA ||
+			 info->run == LIVE || info->run == MEASURE))
 		do_error(1234, form_method, getvars, postvars, info);
 
-	if (!info->sdisplay.tdom)
-		if (!info->sdisplay.hw_fft && (info->stime_s.fsamples > 10)) {
-			info->stime_s.fsamples = 10;
+	if (info->sdisplay.save_fmt > SAVE_SIGMF)
+		info->sdisplay.save_fmt = SAVE_BINARY;
+
+	/* a complex I/Q capture has negative frequencies to zoom into */
+	if (!info->sdisplay.tdom && info->sdisplay.zoom &&
+	    (info->szoom.span <= 0 ||
+	     (info->szoom.centre < 0 && info->channel_en_mask != 3)))
+		do_error(RANGE, form_method, getvars, postvars, info);
+
+	if (info->sfilter.type &&
+	    filter_load(info, info->sfilter.coef ?
+			postvars[info->sfilter.coef] : NULL) < 0)
+		do_error(COEF_FILE, form_method, getvars, postvars, info);
+
+	/* the cross spectrum needs two channels or a slave board */
+	if (!info->sdisplay.tdom && info->sdisplay.cross &&
+	    info->sinput.slaveadc == 0xFFFF &&
+	    info->channel_en_mask != 3 && info->id != ID_AD9250)
+		do_error(CHANNELS, form_method, getvars, postvars, info);
+
+	/* I/Q baseband is ch0 + j ch1 */
+	if (!info->sdisplay.tdom && info->sdisplay.iq &&
+	    info->channel_en_mask != 3)
+		do_error(CHANNELS, form_method, getvars, postvars, info);
+
+	/* every display's FFT, frame, segment or zoom size is 1 << fsamples */
+	if (info->stime_s.fsamples > LOG2_N_WAVE32)
+		info->stime_s.fsamples = LOG2_N_WAVE32;
+
+	/*
+	 * zoom, waterfall and cross spectrum keep the capture depth, the
+	 * FFT size applies after decimation or per frame/segment; tone
+	 * measurements use the whole capture. FFT size 0 transforms the
+	 * capture depth, of any length.
+	 */
+	if (!info->sdisplay.tdom && !info->sdisplay.zoom &&
+	    !info->sdisplay.waterfall && !info->sdisplay.cross) {
+		if (info->stime_s.fsamples && info->run != TONE) {
+			info->stime_s.samples = 1 << info->stime_s.fsamples;
+		} else if (info->sdisplay.hw_fft && !info->stime_s.fsamples) {
+			/* the FFT core only does powers of two */
+			while (info->stime_s.fsamples < 16 &&
+			       (2U << info->stime_s.fsamples) <= info->stime_s.samples)
+				info->stime_s.fsamples++;
 			info->stime_s.samples = 1 << info->stime_s.fsamples;
 		}
+	}
 
 // 	if (info->stime_s.sps > (MAXSAMPLERATE)
 // 	    || (info->stime_s.sps <= MINSAMPLERATE))
@@ -675,6 +949,24 @@ get_sample_freq(int form_method, char **getvars, char **postvars, s_info * info)
 	return ret;
 }
 
+/* the analyses of the retained captures, once they are all in */
+static void
+get_results(int form_method, char **getvars, char **postvars, s_info * info)
+{
+	FILE *out = NULL;
+
+	/* the cross spectra replace the empty plot data file */
+	if (info->sdisplay.cross && !info->sdisplay.tdom && info->run != TONE) {
+		out = fopen(info->pFILENAME_T_OUT, "w");
+		if (out == NULL)
+			do_error(FILE_OPEN, form_method, getvars, postvars, info);
+	}
+	if (capture_results(info, out) < 0)
+		do_error(CHANNELS, form_method, getvars, postvars, info);
+	if (out)
+		fclose(out);
+}
+
 int
 system_sync(int form_method, char **getvars, char **postvars, s_info * info)
 {
@@ -721,6 +1013,9 @@ make_file_samples(int form_method, char **getvars, char **postvars, s_info * inf
 			     postvars[info->sinput.device],
 			     (info->sinput.slaveadc == 0xFFFF) ? NULL : postvars[info->sinput.slaveadc]);
 
+	/* the zoom span is too narrow for the depth */
+	if (ret == -ERANGE)
+		do_error(RANGE, form_method, getvars, postvars, info);
 	if (ret < 0) {
 		do_error(IIO_OPEN, form_method, getvars, postvars, info);
 	}
@@ -728,24 +1023,61 @@ make_file_samples(int form_method, char **getvars, char **postvars, s_info * inf
 	return ret;
 }
 
-int
-make_file_init(int form_method, char **getvars, char **postvars, s_info * info)
+/* finish a spectrum plot command with the held traces, column 3 */
+void plot_hold(s_info * info, char *x)
 {
-//	int i, j;
-	/* open file for write */
-	unsigned has_slave = info->has_slave;
-
-	info->pFile_init = fopen(info->pFILENAME_GNUPLT, "w");
+	/* the HW FFT output is written as is, without a held trace */
+	if (info->sdisplay.hold &&
+	    (info->sdisplay.zoom || !info->sdisplay.hw_fft)) {
+		fprintf(info->pFile_init, ", \"%s\" using %s:3 title \"%s%s\"",
+			info->pFILENAME_T_OUT, x, info->has_slave ? "LPC " : "",
+			trace_name(info));
+		if (info->has_slave)
+			fprintf(info->pFile_init, ", \"%s\" using %s:3 title \"HPC %s\"",
+				info->pFILENAME_T_OUT2, x, trace_name(info));
+	}
+	fprintf(info->pFile_init, "\n");
+}
 
-	if (info->pFile_init == NULL) {
-		do_error(FILE_OPEN, form_method, getvars, postvars, info);
+/* label the peak markers; x is in Hz, or in bins for the unscaled FFT */
+void plot_markers(s_info * info, int hz)
+{
+	s_markers *mk;
+	unsigned b, i, tag = 1;
+
+	for (b = 0; b < (info->has_slave ? 2 : 1); b++) {
+		mk = &info->smarkers[b];
+		for (i = 0; i < mk->n; i++, tag++)
+			fprintf(info->pFile_init,
+				"set label %u \"%sM%u\" at %f,%f point pt 7 offset 0.5,0.5\n",
+				tag, b ? "H" : "", i + 1,
+				hz ? mk->peak[i].freq : mk->peak[i].bin,
+				mk->peak[i].db);
 	}
+}
 
-	/* print header information */
+/* one panel of the cross spectrum, column col of the first pair */
+void plot_cross(s_info * info, int col)
+{
+	unsigned p;
+
+	fprintf(info->pFile_init, "plot ");
+	for (p = 0; p < info->scross.npairs; p++)
+		fprintf(info->pFile_init, "%s\"%s\" using 1:%d title \"%s\"",
+			p ? ", " : "", info->pFILENAME_T_OUT, col + 4 * p,
+			info->scross.pair[p].name);
+	fprintf(info->pFile_init, "\n");
+}
 
-	fprintf(info->pFile_init, "#GNUPLOT File generated by NDSO\n");
-	fprintf(info->pFile_init, "set term png\nset output \"../img%s.png\"\n",
-		info->pREMOTE_ADDR);
+/*
+ * Everything after the terminal and output settings. With inl, the time
+ * domain and FFT traces are read inline, see gnuplot_plot_binary().
+ */
+void plot_script(s_info * info, char **postvars, const s_plot * inl)
+{
+//	int i, j;
+	unsigned has_slave = info->has_slave;
+	char x[64], shift[32] = "";
 
 	/* print commands */
 
@@ -782,60 +1114,123 @@ make_file_init(int form_method, char **getvars, char **postvars, s_info * info)
 			info->stime_s.samples, info->stime_s.sps);
 		fprintf(info->pFile_init, "set ylabel \"ADC Values\" \n");
 
-		switch (info->channel_en_mask) {
+		/* moves the lagging trace back onto the first one */
+		if (info->sdisplay.align && info->scorr.valid)
+			snprintf(shift, sizeof(shift), "%+f", -info->scorr.delay);
+
+		if (inl)
+			gnuplot_plot_binary(info->pFile_init, inl);
+		else switch (info->channel_en_mask) {
 		case 3:
 			if (has_slave)
-				fprintf(info->pFile_init, "plot \"%s\" using 3:1 title \"LPC_CH0\", '' using 3:2 title \"LPC_CH1\", \"%s\" using 3:1 title \"HPC_CH0\", '' using 3:2 title \"HPC_CH1\"\n", info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2);
+				fprintf(info->pFile_init, "plot \"%s\" using 3:1 title \"LPC_CH0\", '' using 3:2 title \"LPC_CH1\", \"%s\" using ($3%s):1 title \"HPC_CH0\", '' using ($3%s):2 title \"HPC_CH1\"\n", info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2, shift, shift);
 			else
-				fprintf(info->pFile_init, "plot \"%s\" using 3:1 title \"ch0\", '' using 3:2 title \"ch1\"\n", info->pFILENAME_T_OUT);
+				fprintf(info->pFile_init, "plot \"%s\" using 3:1 title \"ch0\", '' using ($3%s):2 title \"ch1\"\n", info->pFILENAME_T_OUT, shift);
 			break;
 		case 2:
 			if (has_slave)
-				fprintf(info->pFile_init, "plot \"%s\" title \"LPC_CH1\", \"%s\" title \"HPC_CH1\"\n", info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2);
+				fprintf(info->pFile_init, "plot \"%s\" title \"LPC_CH1\", \"%s\" using ($0%s):1 title \"HPC_CH1\"\n", info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2, shift);
 			else
 				fprintf(info->pFile_init, "plot \"%s\" title \"ch1\"\n", info->pFILENAME_T_OUT);
 			break;
 		case 1:
 			if (has_slave)
-				fprintf(info->pFile_init, "plot \"%s\" title \"LPC_CH0\", \"%s\" title \"HPC_CH0\"\n", info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2);
+				fprintf(info->pFile_init, "plot \"%s\" title \"LPC_CH0\", \"%s\" using ($0%s):1 title \"HPC_CH0\"\n", info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2, shift);
 			else
 				fprintf(info->pFile_init, "plot \"%s\" title \"ch0\"\n", info->pFILENAME_T_OUT);
 			break;
 		}
+	} else if (info->sdisplay.cross) {
+		fprintf(info->pFile_init,
+			"set xlabel \"%d point FFT, %d segments @ %d Samples/s               f/Hz->\"\n",
+			info->scross.nfft, info->scross.segments, info->stime_s.sps);
+		fprintf(info->pFile_init, "set multiplot layout 3,1\n");
+		fprintf(info->pFile_init, "set ylabel \"Cross PSD in dB\" \n");
+		plot_cross(info, 2);
+		fprintf(info->pFile_init, "set ylabel \"Coherence\" \nset yrange [0:1.05]\n");
+		plot_cross(info, 3);
+		fprintf(info->pFile_init, "set ylabel \"Phase in deg\" \nset yrange [-180:180]\nset ytics 90\n");
+		plot_cross(info, 4);
+		fprintf(info->pFile_init, "unset multiplot\n");
+	} else if (info->sdisplay.zoom) {
+		fprintf(info->pFile_init, "set ylabel \"Magnitude in dB\" \n");
+		fprintf(info->pFile_init,
+			"set xlabel \"%d point zoom FFT, %.0f Hz span @ %.0f Samples/s               f/Hz->\"\n",
+			info->szoom.nfft, info->szoom.span, info->szoom.rate);
+		plot_markers(info, 1);
+		if (has_slave)
+			fprintf(info->pFile_init,
+				"plot  \"%s\" using 1:2 title \"LPC\", \"%s\" using 1:2 title \"HPC\"",
+				info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2);
+		else
+			fprintf(info->pFile_init,
+				"plot  \"%s\" using 1:2 title \"Zoom FFT\"",
+				info->pFILENAME_T_OUT);
+		plot_hold(info, "1");
+	} else if (info->sdisplay.waterfall) {
+		fprintf(info->pFile_init, "set ylabel \"Magnitude in dB\" \n");
+		fprintf(info->pFile_init,
+			"set xlabel \"%d point FFT, newest of %d frames @ %d Samples/s               f/Hz->\"\n",
+			info->swaterfall.nfft, info->swaterfall.frames, info->stime_s.sps);
+		plot_markers(info, 1);
+		if (has_slave)
+			fprintf(info->pFile_init,
+				"plot  \"%s\" using 1:2 title \"LPC\", \"%s\" using 1:2 title \"HPC\"\n",
+				info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2);
+		else
+			fprintf(info->pFile_init,
+				"plot  \"%s\" using 1:2 title \"FFT\"\n",
+				info->pFILENAME_T_OUT);
 	} else {
 		fprintf (info->pFile_init, "set ylabel \"Magnitude in dB\" \n");
 
 	      if (info->sdisplay.fftscaled)
 		{
 		  fprintf (info->pFile_init,
-			   "set xlabel \"%d point FFT @ %d Samples/s               f/Hz->\"\n",
-			   info->stime_s.samples, info->stime_s.sps);
+			   "set xlabel \"%d point %sFFT @ %d Samples/s               f/Hz->\"\n",
+			   info->stime_s.samples, info->sdisplay.iq && !info->sdisplay.hw_fft ? "I/Q " : "",
+			   info->stime_s.sps);
+		plot_markers(info, 1);
+		if (inl)
+			gnuplot_plot_binary(info->pFile_init, inl);
+		else {
 		if (has_slave)
 			   fprintf (info->pFile_init,
-			   "plot  \"%s\" using ($1*%d/%d):($2) title \"LPC\", \"%s\" using ($1*%d/%d):($2) title \"HPC\" \nexit\n",
+			   "plot  \"%s\" using ($1*%d/%d):($2) title \"LPC\", \"%s\" using ($1*%d/%d):($2) title \"HPC\"",
 			   info->pFILENAME_T_OUT, info->stime_s.sps,
 			   info->stime_s.samples,
 			   info->pFILENAME_T_OUT2, info->stime_s.sps,
 			   info->stime_s.samples);
 		else
 			   fprintf (info->pFile_init,
-			   "plot  \"%s\" using ($1*%d/%d):($2) title \"FFT\" \nexit\n",
+			   "plot  \"%s\" using ($1*%d/%d):($2) title \"FFT\"",
 			   info->pFILENAME_T_OUT, info->stime_s.sps,
 			   info->stime_s.samples);
+		snprintf(x, sizeof(x), "($1*%d/%d)",
+			 info->stime_s.sps, info->stime_s.samples);
+		plot_hold(info, x);
+		}
 		}
 	      else
 		{
 		  fprintf (info->pFile_init,
-			   "set xlabel \"%d point FFT @ %d Samples/s               f->\"\n",
-			   info->stime_s.samples, info->stime_s.sps);
+			   "set xlabel \"%d point %sFFT @ %d Samples/s               f->\"\n",
+			   info->stime_s.samples, info->sdisplay.iq && !info->sdisplay.hw_fft ? "I/Q " : "",
+			   info->stime_s.sps);
+		plot_markers(info, 0);
+		if (inl)
+			gnuplot_plot_binary(info->pFile_init, inl);
+		else {
 		if (has_slave)
 			   fprintf (info->pFile_init,
-			   "plot  \"%s\" using 1:($2) title \"LPC\", \"%s\" using 1:($2) title \"HPC\" \nexit\n",
+			   "plot  \"%s\" using 1:($2) title \"LPC\", \"%s\" using 1:($2) title \"HPC\"",
 			   info->pFILENAME_T_OUT, info->pFILENAME_T_OUT2);
 		else
 			   fprintf (info->pFile_init,
-			   "plot  \"%s\" using 1:($2) title \"FFT\"  \nexit\n",
+			   "plot  \"%s\" using 1:($2) title \"FFT\"",
 			   info->pFILENAME_T_OUT);
+		plot_hold(info, "1");
+		}
 		}
 	}
 
@@ -868,7 +1263,24 @@ make_file_init(int form_method, char **getvars, char **postvars, s_info * info)
 //					j - 1);
 //		}
 //	}
-	fprintf(info->pFile_init, "exit\n");
+}
+
+int
+make_file_init(int form_method, char **getvars, char **postvars, s_info * info)
+{
+	info->pFile_init = fopen(info->pFILENAME_GNUPLT, "w");
+
+	if (info->pFile_init == NULL) {
+		do_error(FILE_OPEN, form_method, getvars, postvars, info);
+	}
+
+	/* print header information */
+
+	fprintf(info->pFile_init, "#GNUPLOT File generated by NDSO\n");
+	fprintf(info->pFile_init, "set term png\nset output \"../img%s.png\"\n",
+		info->pREMOTE_ADDR);
+
+	plot_script(info, postvars, NULL);
 
 	/* close file */
 
@@ -909,16 +1321,42 @@ int main()
 //			info->stime_s.sps = 250000000;
 		info->num_channels =
 		    make_file_samples(form_method, getvars, postvars, info);
+		get_results(form_method, getvars, postvars, info);
 		make_file_init(form_method, getvars, postvars, info);
-		system(info->pGNUPLOT);
+		/* the script is kept, for the displays not drawn natively */
+		if ((info->sdisplay.gnuplot || plot_render(info, postvars) < 0) &&
+		    gnuplot_render(info, postvars) < 0)
+			system(info->pGNUPLOT);
 		do_html(form_method, getvars, postvars, info);
 		display_on_framebuffer(info);
 		break;
 	case SAVE:
+		/* a resumed download, of the capture it started with */
+		if (getenv("HTTP_RANGE") &&
+		    do_save(form_method, getvars, postvars, info, 1) != -ENOENT)
+			break;
+		/* for the file headers, the capture doesn't need it */
+		iio_read_devattr(postvars[info->sinput.device],
+				 "in_voltage_sampling_frequency", &info->stime_s.sps);
 		info->num_channels =
 		    make_file_samples(form_method, getvars, postvars, info);
 		do_html(form_method, getvars, postvars, info);
 		break;
+	case TONE:
+	case DATA:
+		get_sample_freq(form_method, getvars, postvars, info);
+		info->num_channels =
+		    make_file_samples(form_method, getvars, postvars, info);
+		get_results(form_method, getvars, postvars, info);
+		do_html(form_method, getvars, postvars, info);
+		break;
+	case LIVE:
+	case MEASURE:
+		get_sample_freq(form_method, getvars, postvars, info);
+		if (stream_run(form_method, getvars, postvars, info) < 0)
+			syslog(LOG_INFO, "live stream ended with an error\n");
+		cleanUp(form_method, getvars, postvars);
+		break;
 
 	case SHOWDEVATTR:
 	case GNUPLOT_FILES:
@@ -4,15 +4,29 @@
  * Licensed under the GPL-2.
  */
 
+#include <stdint.h>
+
 /* ------------ Defines ------------ */
 
 #define DEBUG 				0
 
+#define GNUPLOT_BIN "/usr/bin/gnuplot"
 #define CALL_GNUPLOT "/usr/bin/gnuplot /var/www/data/cgi-bin/gnu.plt_"
 #define FILENAME_T_OUT "/var/www/data/cgi-bin/t_samples.txt_"
 #define FILENAME_T_OUT2 "/var/www/data/cgi-bin/t_samples2.txt_"
 #define FILENAME_F_OUT "/var/www/data/cgi-bin/f_samples.txt_"
 #define FILENAME_GNUPLT "/var/www/data/cgi-bin/gnu.plt_"
+#define FILENAME_GP_FIFO "/var/www/data/cgi-bin/gnu.fifo_"
+#define FILENAME_GP_ACK "/var/www/data/cgi-bin/gnu.ack_"
+#define FILENAME_GP_PID "/var/www/data/cgi-bin/gnu.pid_"
+#define FILENAME_WF "/var/www/data/cgi-bin/wf.dat_"
+#define FILENAME_WF_IMG "/var/www/data/wf"
+#define FILENAME_PE "/var/www/data/cgi-bin/pe.dat_"
+#define FILENAME_PE_IMG "/var/www/data/pe"
+#define FILENAME_IMG "/var/www/data/img"
+#define FILENAME_COEF		"/var/www/data/coef/"
+#define FILENAME_TRACE "/var/www/data/cgi-bin/trace.dat_"
+#define FILENAME_SAVE "/var/www/data/cgi-bin/save.dat_"
 
 #define VALUE_FRAME "\n<html>\n<head>\n<meta http-equiv=\"Content-Type\" content=\"text/html; charset=windows-1252\">\n<title></title></head><body> <p><font face=\"Tahoma\" size=\"10\">%4.3f Volt</font></p>\n"
 
@@ -36,8 +50,39 @@
 #define fixed short
 #endif
 
+#define METRICS_HARMONICS	6	/* highest harmonic in THD */
+#define MARKER_MAX		10	/* peak markers */
+#define MARKER_HARMONICS	4	/* harmonic markers, 2nd to 5th */
+#define MARKER_SEARCH		2	/* bins searched around a harmonic */
+#define TONE_MAX		16	/* tones per measurement */
+#define N_LOW_PASS		31	/* taps of Low_pass[] in int_fft.c */
+#define LOG2_N_WAVE32		16	/* largest fix_fft32() in int_fft.c */
+#define BINARY_OFFSET		0	/* ADC code of 0 V */
+#define ADC_FULL_SCALE		8192.0	/* 14 bit, as the 14->16 bit FFT scale */
+#define PLOT_W			640	/* native plot at size ratio 1 */
+#define PLOT_H			480
+#define PLOT_TRACES		8
+#define PLOT_LABELS		(2 * MARKER_MAX)
+#define PLOT_REDUCED		(2 * PLOT_W * MAXSIZERATIO)	/* min/max per column */
+#define TEXT_BUF		65536	/* formatted data per fwrite() */
+
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
+/* fields of the little endian file formats */
+static inline void put_le16(unsigned char *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
 
 /* ------------ Structs ------------ */
 
@@ -61,6 +106,21 @@ typedef struct {
 	unsigned short fftexludezero;
 	unsigned short window;
 	unsigned short hw_fft;
+	unsigned short zoom;
+	unsigned short waterfall;
+	unsigned short wfclear;
+	unsigned short hold;
+	unsigned short holdavg;
+	unsigned short holdreset;
+	unsigned short cross;
+	unsigned short corr;
+	unsigned short align;
+	unsigned short persist;
+	unsigned short iq;
+	unsigned short iqbal;
+	unsigned short gnuplot;
+	unsigned short save_fmt;
+	unsigned short live_fps;
 } display;
 
 typedef struct {
@@ -75,11 +135,177 @@ typedef struct {
 	unsigned int fsamples;
 } time_set;
 
+typedef struct {
+	double centre;
+	double span;
+	double rate;
+	unsigned len;
+	unsigned nfft;
+} zoom_set;
+
+typedef struct {
+	unsigned nfft;
+	unsigned frames;
+} waterfall_set;
+
+typedef struct {
+	char name[16];
+	float freq;
+	float coherence;
+	float phase;
+	float gain;
+} cross_pair;
+
+typedef struct {
+	unsigned nfft;
+	unsigned segments;
+	unsigned npairs;
+	cross_pair pair[2];
+} cross_set;
+
+typedef struct {
+	float period;		/* samples */
+	unsigned short decay;	/* old hits lose 1 / 2^decay per capture */
+	unsigned short clear;
+	unsigned count;
+} persist_set;
+
+typedef struct {
+	int valid;
+	int lag;		/* integer part of delay */
+	float delay;		/* samples, second channel lagging first */
+	float quality;		/* correlation coefficient at the peak */
+} corr_set;
+
+typedef struct {
+	unsigned short type;
+	unsigned short coef;	/* postvars index of the coefficient file */
+	unsigned ntaps;		/* FIR taps or IIR sections */
+	int q15;
+	float *taps;		/* reversed FIR taps, or b0 b1 b2 a1 a2 */
+	short *qtaps;		/* reversed Q15 FIR taps */
+} filter_set;
+
+typedef struct {
+	unsigned n;
+	double freq[TONE_MAX];
+} tone_set;
+
+typedef struct {
+	int n;
+	float threshold;
+} marker_set;
+
+typedef struct {
+	float bin;
+	float freq;
+	float db;
+} s_marker;
+
+typedef struct {
+	unsigned n;
+	unsigned nharm;
+	s_marker peak[MARKER_MAX];
+	s_marker harm[MARKER_HARMONICS];	/* dB relative to peak[0] */
+} s_markers;
+
+typedef struct {
+	short *data;
+	unsigned samples;
+	unsigned samples_per_scan;
+	double time;		/* seconds since the epoch, at the read */
+} s_capture;
+
+typedef struct {
+	unsigned valid;
+	float fund_bin;
+	float fund_dbfs;
+	float snr;
+	float sinad;
+	float sfdr;
+	float thd;
+	float enob;
+	float snr_fs;
+	float sinad_fs;
+	float sfdr_fs;
+	float thd_fs;
+	float enob_fs;
+	unsigned spur_bin;
+	unsigned harm_bin[METRICS_HARMONICS - 1];
+	float harm_dbc[METRICS_HARMONICS - 1];
+} s_metrics;
+
+typedef struct {
+	unsigned valid;
+	int bin;		/* tone, negative below DC */
+	float irr;		/* image rejection, dB */
+	float gain;		/* Q relative to I, dB */
+	float phase;		/* deviation from quadrature, deg */
+} s_iq;
+
+typedef struct {
+	float *db;
+	float *hold;		/* held trace, or NULL */
+	unsigned n;
+	int k0;			/* bin of db[0], negative for I/Q */
+} s_spectrum;
+
+typedef struct {
+	const short *s;		/* samples, stride apart, or */
+	const float *f;		/* values, non finite ones leave a gap */
+	unsigned stride;
+	unsigned n;
+	double x0;		/* x of value i is x0 + i * dx */
+	double dx;
+	char title[24];
+} plot_trace;
+
+typedef struct {
+	double x;
+	double y;
+	char text[8];
+} plot_label;
+
+typedef struct {
+	unsigned w;
+	unsigned h;
+	char xlabel[96];
+	char ylabel[32];
+	double xmin;		/* NAN autoscales */
+	double xmax;
+	double ytics;		/* 0 for automatic */
+	unsigned short grid;
+	unsigned short zeroaxis;
+	unsigned short logx;
+	unsigned short logy;
+	unsigned short style;
+	unsigned short color;	/* of the first trace */
+	unsigned ntraces;
+	unsigned nlabels;
+	plot_trace trace[PLOT_TRACES];
+	plot_label label[PLOT_LABELS];
+	float reduced[PLOT_TRACES][PLOT_REDUCED];	/* see plot_reduce() */
+} s_plot;
+
+typedef struct {
+	FILE *out;
+	unsigned len;
+	char buf[TEXT_BUF];
+} s_text;			/* batched data file output, see text.c */
+
 typedef struct {
 	display sdisplay;
 	vertical svertical;
 	input sinput;
 	time_set stime_s;
+	zoom_set szoom;
+	waterfall_set swaterfall;
+	cross_set scross;
+	corr_set scorr;
+	persist_set spersist;
+	filter_set sfilter;
+	tone_set stone;
+	marker_set smarker;
 	unsigned short num_channels;
 	unsigned long channel_en_mask;
 	unsigned short run;
@@ -91,6 +317,12 @@ typedef struct {
 	char *pFILENAME_T_OUT;
 	char *pFILENAME_T_OUT2;
 	char *pFILENAME_GNUPLT;
+	char *pFILENAME_WF;
+	char *pFILENAME_WF_IMG;
+	char *pFILENAME_PE;
+	char *pFILENAME_PE_IMG;
+	char *pFILENAME_IMG;
+	char *pFILENAME_SAVE;
 	char *pGNUPLOT;
 	char *pREMOTE_ADDR;
 	unsigned long reg;
@@ -101,6 +333,12 @@ typedef struct {
 	int min_ch1;
 	int max_ch0;
 	int max_ch1;
+	s_metrics smetrics[2];
+	s_markers smarkers[2];
+	s_iq siq[2];
+	s_capture scapture[2];	/* LPC, HPC */
+	s_spectrum sspectrum[2];
+	int hold_count;
 	unsigned id;
 } s_info;
 
@@ -115,10 +353,29 @@ typedef struct {
 
 enum {
 	ACQUIRE, SAVE, SHOWDEVATTR, GNUPLOT_FILES, WRITEREG, READREG, WSYSFS, TEST,
+	TONE, DATA, LIVE, MEASURE,
 };				/* what program we want to run */
 
 enum {
-	IIO_OPEN, FILE_OPEN, SAMPLE_RATE, SAMPLE_DEPTH, SIZE_RATIO, RANGE, TIME_OUT
+	HOLD_OFF, HOLD_MAX, HOLD_MIN, HOLD_EXP_AVG, HOLD_LIN_AVG,
+};				/* held spectrum trace */
+
+enum {
+	PLOT_LINESPOINTS, PLOT_POINTS, PLOT_DOTS, PLOT_LINES, PLOT_IMPULSES,
+	PLOT_FSTEPS, PLOT_HISTEPS, PLOT_BOXES, PLOT_STEPS,
+};				/* data style, as gnuplot's */
+
+enum {
+	SAVE_BINARY, SAVE_TEXT, SAVE_SIGMF,
+};				/* Acquire Save format */
+
+enum {
+	FILTER_OFF, FILTER_LOW_PASS, FILTER_FIR, FILTER_IIR,
+};				/* filter stage */
+
+enum {
+	IIO_OPEN, FILE_OPEN, SAMPLE_RATE, SAMPLE_DEPTH, SIZE_RATIO, RANGE, TIME_OUT,
+	CHANNELS, COEF_FILE, NO_CAPTURE
 };
 
 /* ------------ function prototypes ------------ */
@@ -132,10 +389,102 @@ int iio_write_devattr(char *device_name, char *attr, unsigned int value);
 int iio_read_devattr(char *device_name, char *attr, unsigned int *value);
 int debugfs_write_devattr(char *device_name, char *attr, unsigned int value, int type, unsigned int value2);
 int debugfs_read_devattr(char *device_name, char *attr, unsigned int *value);
+int do_error(int errnum, int form_method, char **getvars, char **postvars,
+	     s_info * info);
 
 
 extern int fix_fft (fixed *, fixed *, int, int);
 extern int iscale (int, int, int);
 extern void window (fixed *, int);
 extern void fix_loud (fixed loud[], fixed fr[], fixed fi[], int n, int scale_shift);
+extern void fix_loud_db (float loud[], fixed fr[], fixed fi[], int n, int scale_shift);
+extern void power_db (float db[], const float pwr[], int n, float offset);
+extern void fix_power (float pwr[], fixed fr[], fixed fi[], int n);
+extern float fix_loud_offset (int scale_shift);
+extern fixed fix_dot (fixed * hpa, fixed * pb, int n);
+extern int fix_fft32 (int32_t fr[], int32_t fi[], int m, int inverse);
+extern void window32 (int32_t fr[], int n);
+extern void fix_power32 (float pwr[], int32_t fr[], int32_t fi[], int n, int exponent);
+extern fixed Low_pass[N_LOW_PASS];
+
+int adc_metrics(s_metrics *m, const float *pwr, int nbins, int fft_size,
+		int windowed, float offset);
+int iq_imbalance(s_iq * iq, const float *pwr, const short *data, unsigned n,
+		 unsigned samples_per_scan, int windowed);
+
+int cfft(float *re, float *im, int n, int inverse);
+int cfft_power(float *pwr, unsigned nbins, const short *data, unsigned n,
+	       unsigned samples_per_scan, unsigned mask, int windowed);
+void fftshift(float *x, unsigned n);
+void fwindow(float *x, int n);
+
+int marker_find(s_markers * mk, const float *db, int nbins, int fold,
+		const marker_set * set, double f0, double df);
+
+int zoom_sample(s_info * info, char *device_name, short *data,
+		unsigned samples_per_scan, FILE * out, s_markers * mk);
+
+int waterfall_sample(s_info * info, short *data, unsigned samples_per_scan,
+		     FILE * out, int update, s_markers * mk);
+
+int cross_sample(s_info * info, FILE * out);
+int capture_results(s_info * info, FILE * out);
+int corr_delay(s_info * info);
+
+int tone_parse(s_info * info, const char *list);
+int tone_report(s_info * info, FILE * out);
+
+int filter_load(s_info * info, const char *name);
+int filter_capture(s_info * info, short *data, unsigned samples,
+		   unsigned samples_per_scan);
+
+int persist_sample(s_info * info, short *data, unsigned samples_per_scan);
+
+int trace_update(s_info * info, const char *device, const float *db,
+		 float *hold, unsigned n);
+const char *trace_name(s_info * info);
+
+void image_palette(unsigned char palette[256][3]);
+int image_write_bmp(const char *filename, const unsigned char *rgb,
+		    unsigned w, unsigned h);
+int image_write_png(const char *filename, const unsigned char *pix,
+		    unsigned w, unsigned h, const unsigned char palette[][3],
+		    unsigned ncolors);
+
+int plot_style(const char *name);
+int plot_png(const s_plot * p, const char *filename);
+int plot_traces(s_info * info, s_plot * p, char **postvars);
+int plot_retained(s_info * info);
+void plot_options(s_info * info, s_plot * p, char **postvars);
+void plot_reduce(s_plot * p, int all);
+int plot_render(s_info * info, char **postvars);
+void plot_script(s_info * info, char **postvars, const s_plot * inl);
+
+unsigned save_layout(s_info * info, unsigned *mask, unsigned *boards);
+int save_capture(s_info * info, FILE * out, const char *device,
+		 const char *slave);
+int save_store(s_info * info, const char *path, const char *device,
+	       const char *slave);
+
+int sigmf_write(s_info * info, FILE * out, const char *name,
+		const char *device, const char *slave);
+int download_file(const char *path, const char *filename, int ranges);
+
+int data_send(s_info * info, FILE * out);
+int data_frame(s_info * info, const s_plot * p, const char *extra,
+	       unsigned char **buf, unsigned *size);
+int data_measure(s_info * info, const char *extra, char *buf, unsigned size);
+
+int stream_run(int form_method, char **getvars, char **postvars,
+	       s_info * info);
+
+void text_open(s_text * t, FILE * out);
+int text_flush(s_text * t);
+int text_close(s_text * t);
+void text_char(s_text * t, char c);
+void text_int(s_text * t, long long v, char sep);
+void text_fixed(s_text * t, double v, unsigned prec, char sep);
+
+void gnuplot_plot_binary(FILE * fp, const s_plot * p);
+int gnuplot_render(s_info * info, char **postvars);
 
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Persistence (eye diagram) display. The capture is folded modulo a
+ * period into a hit count raster, which lives in a per session file
+ * and accumulates over captures, with an optional decay. The image is
+ * rendered straight from the counts through a log scaled palette.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define PE_W_SHIFT	9
+#define PE_W		(1 << PE_W_SHIFT)	/* columns per period */
+#define PE_H		256
+#define PE_MAGIC	0x4550444e	/* "NDPE" */
+
+struct pe_header {
+	unsigned magic;
+	float period;
+	int ymin;
+	int ymax;
+	unsigned count;
+	unsigned pad[3];
+};
+
+/*
+ * Time of the first rising crossing of the mid level, interpolated
+ * between samples, so every capture folds from the same signal phase.
+ */
+static double persist_trigger(const short *d, unsigned n, unsigned stride)
+{
+	int lo = d[0], hi = d[0], v0, v1, level;
+	unsigned i;
+
+	for (i = 1; i < n; i++) {
+		v1 = d[i * stride];
+		lo = v1 < lo ? v1 : lo;
+		hi = v1 > hi ? v1 : hi;
+	}
+	level = (lo + hi + 1) / 2;
+
+	for (i = 1; i < n; i++) {
+		v0 = d[(i - 1) * stride];
+		v1 = d[i * stride];
+		if (v0 < level && v1 >= level)
+			return i - 1 + (double)(level - v0) / (v1 - v0);
+	}
+
+	return 0;
+}
+
+/*
+ * The phase runs in a 32 bit fixed point accumulator, wrapping once
+ * per period; its top bits are the column. Rows come from a 16.16
+ * scale of the sample clipped to [ymin, ymax], the range set by the
+ * first capture, so the product can't overflow. No floating point or
+ * branches per sample.
+ */
+static void persist_fold(uint16_t *hits, const short *d, unsigned n,
+			 unsigned stride, double t0, double period,
+			 int ymin, int ymax)
+{
+	double ph = fmod(-t0 / period, 1.0);
+	uint32_t acc, step = 4294967296.0 / period;
+	int32_t yscale = ((PE_H - 1) << 16) / (ymax - ymin);
+	uint16_t *h;
+	unsigned i, x;
+	int v, y;
+
+	acc = (ph < 0 ? ph + 1 : ph) * 4294967296.0;
+
+	for (i = 0; i < n; i++, acc += step) {
+		x = acc >> (32 - PE_W_SHIFT);
+		v = d[i * stride];
+		v = v < ymin ? ymin : (v > ymax ? ymax : v);
+		y = ((v - ymin) * yscale) >> 16;
+		h = &hits[(PE_H - 1 - y) * PE_W + x];
+		*h += *h < 0xFFFF;
+	}
+}
+
+static int persist_render(s_info * info, const uint16_t *hits)
+{
+	unsigned char palette[256][3], *lut, *rgb;
+	unsigned i, max = 0;
+	int ret;
+
+	for (i = 0; i < PE_W * PE_H; i++)
+		max = hits[i] > max ? hits[i] : max;
+
+	lut = malloc(max + 1 + PE_W * PE_H * 3);
+	if (lut == NULL)
+		return -ENOMEM;
+	rgb = lut + max + 1;
+
+	/* log scale, a single hit is already visible */
+	lut[0] = 0;
+	for (i = 1; i <= max; i++)
+		lut[i] = 32 + 223 * logf(i) / logf(max > 1 ? max : 2);
+
+	image_palette(palette);
+
+	for (i = 0; i < PE_W * PE_H; i++)
+		memcpy(rgb + i * 3, palette[lut[hits[i]]], 3);
+
+	ret = image_write_bmp(info->pFILENAME_PE_IMG, rgb, PE_W, PE_H);
+
+	free(lut);
+
+	return ret;
+}
+
+/**
+ * persist_sample() - fold a capture into the persistence display
+ * @info:	settings; spersist, stime_s and the session file names
+ * @data:	interleaved capture, samples_per_scan values per sample
+ * @samples_per_scan: values per sample in @data
+ *
+ * The first enabled channel is folded modulo spersist.period samples,
+ * starting at its first rising mid level crossing. The vertical range
+ * is set by the first capture after a clear, with 10% margin. Before
+ * new hits are added the old ones decay by 1 / 2^spersist.decay, if
+ * that is non zero.
+ *
+ * Returns 0 on success or a negative errno.
+ **/
+int persist_sample(s_info * info, short *data, unsigned samples_per_scan)
+{
+	unsigned n = info->stime_s.samples;
+	unsigned c = (info->channel_en_mask & 1) ? 0 : 1;
+	size_t len = sizeof(struct pe_header) + PE_W * PE_H * sizeof(uint16_t);
+	const short *d = data + (c < samples_per_scan ? c : 0);
+	struct pe_header *hdr;
+	uint16_t *hits;
+	int fd, ret, lo, hi, m;
+	unsigned i;
+
+	if (info->spersist.period < 2 || info->spersist.decay > 15 || n < 2)
+		return -EINVAL;
+
+	fd = open(info->pFILENAME_PE, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -errno;
+
+	flock(fd, LOCK_EX);
+
+	if (ftruncate(fd, len) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+	hits = (uint16_t *)(hdr + 1);
+
+	if (info->spersist.clear || hdr->magic != PE_MAGIC ||
+	    hdr->period != info->spersist.period) {
+		lo = hi = d[0];
+		for (i = 1; i < n; i++) {
+			lo = d[i * samples_per_scan] < lo ? d[i * samples_per_scan] : lo;
+			hi = d[i * samples_per_scan] > hi ? d[i * samples_per_scan] : hi;
+		}
+		m = (hi - lo) / 10 + 1;
+		hdr->magic = PE_MAGIC;
+		hdr->period = info->spersist.period;
+		hdr->ymin = lo - m;
+		hdr->ymax = hi + m;
+		hdr->count = 0;
+		memset(hits, 0, PE_W * PE_H * sizeof(uint16_t));
+	}
+
+	/* rounded up, so single hits fade out too */
+	if (info->spersist.decay)
+		for (i = 0; i < PE_W * PE_H; i++)
+			hits[i] -= (hits[i] + (1 << info->spersist.decay) - 1) >>
+				info->spersist.decay;
+
+	persist_fold(hits, d, n, samples_per_scan,
+		     persist_trigger(d, n, samples_per_scan),
+		     info->spersist.period, hdr->ymin, hdr->ymax);
+	hdr->count++;
+	info->spersist.count = hdr->count;
+
+	ret = persist_render(info, hits);
+
+	munmap(hdr, len);
+	close(fd);
+
+	return ret;
+}
@@ -0,0 +1,963 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Native plot renderer. Time domain traces and spectra are drawn from
+ * the retained captures and spectra into a palette image, stored as
+ * PNG, without the round trip through the text files and a gnuplot
+ * process. Layout and options follow the gnuplot script written by
+ * make_file_init(), which is still used for the displays not drawn
+ * here (cross spectrum, zoom, waterfall and the HW FFT).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define FONT_W		6	/* 5x7 glyphs in a 6x8 cell */
+#define FONT_H		8
+#define TICK_LEN	5
+#define MAX_TICKS	64
+
+enum {
+	COL_BG, COL_FG, COL_GRID, COL_RED, COL_GREEN, COL_BLUE, COL_MAGENTA,
+	COL_CYAN, COL_SIENNA, COL_ORANGE, NCOLORS
+};
+
+static const unsigned char plot_palette[NCOLORS][3] = {
+	{255, 255, 255}, {0, 0, 0}, {160, 160, 160}, {255, 0, 0},
+	{0, 192, 0}, {0, 0, 255}, {192, 0, 192}, {0, 160, 160},
+	{160, 82, 45}, {255, 128, 0},
+};
+
+/* gnuplot's line types, the colour select picks the first one */
+static const unsigned char trace_colors[] = {
+	COL_RED, COL_GREEN, COL_BLUE, COL_MAGENTA, COL_CYAN, COL_SIENNA,
+	COL_ORANGE, COL_FG,
+};
+
+/* ASCII 32 to 126, a byte per column, bit 0 at the top */
+static const unsigned char font5x7[95][5] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5f, 0x00, 0x00},
+	{0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7f, 0x14, 0x7f, 0x14},
+	{0x24, 0x2a, 0x7f, 0x2a, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+	{0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00},
+	{0x00, 0x1c, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1c, 0x00},
+	{0x14, 0x08, 0x3e, 0x08, 0x14}, {0x08, 0x08, 0x3e, 0x08, 0x08},
+	{0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},
+	{0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+	{0x3e, 0x51, 0x49, 0x45, 0x3e}, {0x00, 0x42, 0x7f, 0x40, 0x00},
+	{0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4b, 0x31},
+	{0x18, 0x14, 0x12, 0x7f, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},
+	{0x3c, 0x4a, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+	{0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1e},
+	{0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},
+	{0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+	{0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},
+	{0x32, 0x49, 0x79, 0x41, 0x3e}, {0x7e, 0x11, 0x11, 0x11, 0x7e},
+	{0x7f, 0x49, 0x49, 0x49, 0x36}, {0x3e, 0x41, 0x41, 0x41, 0x22},
+	{0x7f, 0x41, 0x41, 0x22, 0x1c}, {0x7f, 0x49, 0x49, 0x49, 0x41},
+	{0x7f, 0x09, 0x09, 0x09, 0x01}, {0x3e, 0x41, 0x49, 0x49, 0x7a},
+	{0x7f, 0x08, 0x08, 0x08, 0x7f}, {0x00, 0x41, 0x7f, 0x41, 0x00},
+	{0x20, 0x40, 0x41, 0x3f, 0x01}, {0x7f, 0x08, 0x14, 0x22, 0x41},
+	{0x7f, 0x40, 0x40, 0x40, 0x40}, {0x7f, 0x02, 0x0c, 0x02, 0x7f},
+	{0x7f, 0x04, 0x08, 0x10, 0x7f}, {0x3e, 0x41, 0x41, 0x41, 0x3e},
+	{0x7f, 0x09, 0x09, 0x09, 0x06}, {0x3e, 0x41, 0x51, 0x21, 0x5e},
+	{0x7f, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},
+	{0x01, 0x01, 0x7f, 0x01, 0x01}, {0x3f, 0x40, 0x40, 0x40, 0x3f},
+	{0x1f, 0x20, 0x40, 0x20, 0x1f}, {0x3f, 0x40, 0x38, 0x40, 0x3f},
+	{0x63, 0x14, 0x08, 0x14, 0x63}, {0x07, 0x08, 0x70, 0x08, 0x07},
+	{0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7f, 0x41, 0x41, 0x00},
+	{0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7f, 0x00},
+	{0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+	{0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+	{0x7f, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},
+	{0x38, 0x44, 0x44, 0x48, 0x7f}, {0x38, 0x54, 0x54, 0x54, 0x18},
+	{0x08, 0x7e, 0x09, 0x01, 0x02}, {0x0c, 0x52, 0x52, 0x52, 0x3e},
+	{0x7f, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7d, 0x40, 0x00},
+	{0x20, 0x40, 0x44, 0x3d, 0x00}, {0x7f, 0x10, 0x28, 0x44, 0x00},
+	{0x00, 0x41, 0x7f, 0x40, 0x00}, {0x7c, 0x04, 0x18, 0x04, 0x78},
+	{0x7c, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+	{0x7c, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7c},
+	{0x7c, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+	{0x04, 0x3f, 0x44, 0x40, 0x20}, {0x3c, 0x40, 0x40, 0x20, 0x7c},
+	{0x1c, 0x20, 0x40, 0x20, 0x1c}, {0x3c, 0x40, 0x30, 0x40, 0x3c},
+	{0x44, 0x28, 0x10, 0x28, 0x44}, {0x0c, 0x50, 0x50, 0x50, 0x3c},
+	{0x44, 0x64, 0x54, 0x4c, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+	{0x00, 0x00, 0x7f, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00},
+	{0x08, 0x04, 0x08, 0x10, 0x08},
+};
+
+struct canvas {
+	unsigned char *pix;
+	int w, h;
+	int fs;			/* font scale */
+	int left, top, right, bottom;	/* plot area, inclusive */
+};
+
+struct axis {
+	double lo, hi;		/* log10 of the values on a log axis */
+	double step;		/* tic spacing, in decades on a log axis */
+	int log;
+};
+
+static void pset(struct canvas *c, int x, int y, int col)
+{
+	if ((unsigned)x < (unsigned)c->w && (unsigned)y < (unsigned)c->h)
+		c->pix[y * c->w + x] = col;
+}
+
+/* Bresenham, the end points are on the canvas */
+static void line(struct canvas *c, int x0, int y0, int x1, int y1, int col)
+{
+	int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+	int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+	int err = dx + dy, e2;
+
+	for (;;) {
+		c->pix[y0 * c->w + x0] = col;
+		if (x0 == x1 && y0 == y1)
+			break;
+		e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+/* Liang-Barsky against the plot area, 0 if nothing is left */
+static int clip(const struct canvas *c, double *x0, double *y0,
+		double *x1, double *y1)
+{
+	double dx = *x1 - *x0, dy = *y1 - *y0, t0 = 0, t1 = 1, t;
+	double p[4] = { -dx, dx, -dy, dy };
+	double q[4] = { *x0 - c->left, c->right - *x0,
+			*y0 - c->top, c->bottom - *y0 };
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (p[i] == 0) {
+			if (q[i] < 0)
+				return 0;
+			continue;
+		}
+		t = q[i] / p[i];
+		if (p[i] < 0) {
+			if (t > t1)
+				return 0;
+			if (t > t0)
+				t0 = t;
+		} else {
+			if (t < t0)
+				return 0;
+			if (t < t1)
+				t1 = t;
+		}
+	}
+
+	*x1 = *x0 + t1 * dx;
+	*y1 = *y0 + t1 * dy;
+	*x0 += t0 * dx;
+	*y0 += t0 * dy;
+
+	return 1;
+}
+
+static void segment(struct canvas *c, double x0, double y0, double x1,
+		    double y1, int col)
+{
+	if (clip(c, &x0, &y0, &x1, &y1))
+		line(c, lrint(x0), lrint(y0), lrint(x1), lrint(y1), col);
+}
+
+static void point(struct canvas *c, double x, double y, int col)
+{
+	int r = 2 * c->fs;
+
+	segment(c, x - r, y, x + r, y, col);
+	segment(c, x, y - r, x, y + r, col);
+}
+
+static void text(struct canvas *c, int x, int y, const char *s, int col,
+		 int vertical)
+{
+	const unsigned char *g;
+	int k, cx, ry, i, j, px, py;
+
+	for (k = 0; s[k]; k++) {
+		g = font5x7[(s[k] < 32 || s[k] > 126) ? '?' - 32 : s[k] - 32];
+		for (cx = 0; cx < 5; cx++)
+			for (ry = 0; ry < 7; ry++) {
+				if (!(g[cx] & (1 << ry)))
+					continue;
+				px = (k * FONT_W + cx) * c->fs;
+				py = ry * c->fs;
+				for (i = 0; i < c->fs; i++)
+					for (j = 0; j < c->fs; j++)
+						if (vertical)	/* bottom to top */
+							pset(c, x + py + j, y - px - i, col);
+						else
+							pset(c, x + px + i, y + py + j, col);
+			}
+	}
+}
+
+static int text_width(const struct canvas *c, const char *s)
+{
+	return strlen(s) * FONT_W * c->fs;
+}
+
+static double nice_step(double range, int ticks)
+{
+	double s = range / (ticks > 2 ? ticks : 2), p, m;
+
+	p = pow(10, floor(log10(s)));
+	m = s / p;
+
+	return p * (m < 1.5 ? 1 : m < 3.5 ? 2 : m < 7.5 ? 5 : 10);
+}
+
+/*
+ * Autoscaled ends are extended to the next tic, as gnuplot does. A
+ * fixed tic spacing is used unless it gives too many tics.
+ */
+static void axis_fit(struct axis *a, double lo, double hi, int fixlo,
+		     int fixhi, double step, int ticks)
+{
+	if (!(lo <= hi)) {
+		lo = 0;
+		hi = 1;
+	} else if (lo == hi) {
+		lo -= lo ? fabs(lo) / 10 : 1;
+		hi += hi ? fabs(hi) / 10 : 1;
+	}
+
+	if (a->log || step <= 0 || (hi - lo) / step > MAX_TICKS)
+		step = nice_step(hi - lo, ticks);
+	if (a->log)
+		step = ceil(step);
+
+	if (!fixlo)
+		lo = floor(lo / step + 1e-9) * step;
+	if (!fixhi)
+		hi = ceil(hi / step - 1e-9) * step;
+
+	a->lo = lo;
+	a->hi = hi;
+	a->step = step;
+}
+
+/* value in axis units, 0 if it can't be shown */
+static int axis_value(const struct axis *a, double v, double *u)
+{
+	if (a->log) {
+		if (!(v > 0))
+			return 0;
+		v = log10(v);
+	}
+	*u = v;
+
+	return isfinite(v);
+}
+
+static int axis_ticks(const struct axis *a, double *tick)
+{
+	double k = ceil(a->lo / a->step - 1e-9), v;
+	int n = 0;
+
+	for (; n < MAX_TICKS; k++) {
+		v = k * a->step;
+		if (v > a->hi + 1e-9 * a->step)
+			break;
+		tick[n++] = fabs(v) < 1e-9 * a->step ? 0 : v;
+	}
+
+	return n;
+}
+
+static void tick_label(char *s, size_t len, const struct axis *a, double v)
+{
+	snprintf(s, len, "%g", a->log ? pow(10, v) : v);
+}
+
+static double map_x(const struct canvas *c, const struct axis *a, double u)
+{
+	return c->left + (u - a->lo) / (a->hi - a->lo) * (c->right - c->left);
+}
+
+static double map_y(const struct canvas *c, const struct axis *a, double u)
+{
+	return c->bottom - (u - a->lo) / (a->hi - a->lo) * (c->bottom - c->top);
+}
+
+static int trace_value(const plot_trace * t, unsigned i, double *x, double *y)
+{
+	*x = t->x0 + i * t->dx;
+	*y = t->s ? t->s[i * t->stride] : t->f[i];
+
+	return isfinite(*y);
+}
+
+static void plot_trace_draw(struct canvas *c, const s_plot * p,
+			    const plot_trace * t, const struct axis *ax,
+			    const struct axis *ay, int col)
+{
+	double x, y, u, v, px = 0, py = 0, qx = 0, qy = 0, mx, base;
+	int valid, qvalid = 0;
+	unsigned i;
+
+	/* impulses and boxes stand on y = 0, or the bottom if out of range */
+	base = ay->log ? ay->lo : (ay->lo > 0 ? ay->lo : (ay->hi < 0 ? ay->hi : 0));
+	base = map_y(c, ay, base);
+
+	for (i = 0; i < t->n; i++, qx = px, qy = py, qvalid = valid) {
+		valid = trace_value(t, i, &x, &y) &&
+			axis_value(ax, x, &u) && axis_value(ay, y, &v);
+		if (!valid)
+			continue;
+		px = map_x(c, ax, u);
+		py = map_y(c, ay, v);
+		mx = (qx + px) / 2;
+
+		switch (p->style) {
+		case PLOT_LINESPOINTS:
+			point(c, px, py, col);
+			/* fall through */
+		case PLOT_LINES:
+			if (qvalid)
+				segment(c, qx, qy, px, py, col);
+			break;
+		case PLOT_POINTS:
+			point(c, px, py, col);
+			break;
+		case PLOT_DOTS:
+			if (px >= c->left && px <= c->right &&
+			    py >= c->top && py <= c->bottom)
+				pset(c, lrint(px), lrint(py), col);
+			break;
+		case PLOT_IMPULSES:
+			segment(c, px, base, px, py, col);
+			break;
+		case PLOT_STEPS:
+			if (qvalid) {
+				segment(c, qx, qy, px, qy, col);
+				segment(c, px, qy, px, py, col);
+			}
+			break;
+		case PLOT_FSTEPS:
+			if (qvalid) {
+				segment(c, qx, qy, qx, py, col);
+				segment(c, qx, py, px, py, col);
+			}
+			break;
+		case PLOT_BOXES:
+			if (qvalid)
+				segment(c, mx, base, mx, qy < py ? qy : py, col);
+			/* fall through */
+		case PLOT_HISTEPS:
+			if (qvalid) {
+				segment(c, qx, qy, mx, qy, col);
+				segment(c, mx, qy, mx, py, col);
+				segment(c, mx, py, px, py, col);
+			}
+			break;
+		}
+	}
+}
+
+/* data extents within the fixed x range, in axis units */
+static void plot_extents(const s_plot * p, const struct axis *ax,
+			 const struct axis *ay, double *xlo, double *xhi,
+			 double *ylo, double *yhi)
+{
+	const plot_trace *t;
+	double x, y, u, v;
+	unsigned k, i;
+
+	*xlo = *ylo = INFINITY;
+	*xhi = *yhi = -INFINITY;
+
+	for (k = 0; k < p->ntraces; k++) {
+		t = &p->trace[k];
+		for (i = 0; i < t->n; i++) {
+			if (!trace_value(t, i, &x, &y) ||
+			    !axis_value(ax, x, &u) || !axis_value(ay, y, &v))
+				continue;
+			if (x < p->xmin || x > p->xmax)
+				continue;
+			*xlo = u < *xlo ? u : *xlo;
+			*xhi = u > *xhi ? u : *xhi;
+			*ylo = v < *ylo ? v : *ylo;
+			*yhi = v > *yhi ? v : *yhi;
+		}
+	}
+}
+
+static void plot_axes(struct canvas *c, const s_plot * p,
+		      const struct axis *ax, const struct axis *ay)
+{
+	double tick[MAX_TICKS], z;
+	char s[32];
+	int n, i, j, t;
+
+	n = axis_ticks(ax, tick);
+	for (i = 0; i < n; i++) {
+		t = lrint(map_x(c, ax, tick[i]));
+		if (p->grid)
+			for (j = c->top; j <= c->bottom; j += 3)
+				pset(c, t, j, COL_GRID);
+		line(c, t, c->bottom, t, c->bottom - TICK_LEN, COL_FG);
+		line(c, t, c->top, t, c->top + TICK_LEN, COL_FG);
+		tick_label(s, sizeof(s), ax, tick[i]);
+		text(c, t - text_width(c, s) / 2, c->bottom + 4 * c->fs, s,
+		     COL_FG, 0);
+	}
+
+	n = axis_ticks(ay, tick);
+	for (i = 0; i < n; i++) {
+		t = lrint(map_y(c, ay, tick[i]));
+		if (p->grid)
+			for (j = c->left; j <= c->right; j += 3)
+				pset(c, j, t, COL_GRID);
+		line(c, c->left, t, c->left + TICK_LEN, t, COL_FG);
+		line(c, c->right, t, c->right - TICK_LEN, t, COL_FG);
+		tick_label(s, sizeof(s), ay, tick[i]);
+		text(c, c->left - text_width(c, s) - 4 * c->fs,
+		     t - FONT_H * c->fs / 2, s, COL_FG, 0);
+	}
+
+	/* set xzeroaxis lt 2 lw 4 */
+	if (p->zeroaxis && !ay->log && ay->lo < 0 && ay->hi > 0) {
+		z = map_y(c, ay, 0);
+		for (j = -1; j <= 2; j++)
+			segment(c, c->left, z + j, c->right, z + j, COL_GREEN);
+	}
+}
+
+static void plot_key(struct canvas *c, const s_plot * p)
+{
+	int k, y = c->top + 4 * c->fs, x = c->right - 8 * c->fs;
+	int len = 24 * c->fs, col;
+
+	for (k = 0; k < (int)p->ntraces; k++) {
+		if (!p->trace[k].title[0])
+			continue;
+		col = trace_colors[(p->color + k) % sizeof(trace_colors)];
+		text(c, x - len - 4 * c->fs - text_width(c, p->trace[k].title),
+		     y, p->trace[k].title, COL_FG, 0);
+		if (p->style != PLOT_POINTS && p->style != PLOT_DOTS)
+			segment(c, x - len, y + 3 * c->fs, x, y + 3 * c->fs, col);
+		if (p->style == PLOT_POINTS || p->style == PLOT_LINESPOINTS ||
+		    p->style == PLOT_DOTS)
+			point(c, x - len / 2, y + 3 * c->fs, col);
+		y += (FONT_H + 3) * c->fs;
+	}
+}
+
+/* set label "..." at x,y point pt 7 offset 0.5,0.5 */
+static void plot_labels(struct canvas *c, const s_plot * p,
+			const struct axis *ax, const struct axis *ay)
+{
+	const plot_label *l;
+	double u, v;
+	int x, y, i, j, r = 2 * c->fs;
+	unsigned k;
+
+	for (k = 0; k < p->nlabels; k++) {
+		l = &p->label[k];
+		if (!axis_value(ax, l->x, &u) || !axis_value(ay, l->y, &v))
+			continue;
+		x = lrint(map_x(c, ax, u));
+		y = lrint(map_y(c, ay, v));
+		if (x < c->left || x > c->right || y < c->top || y > c->bottom)
+			continue;
+		for (i = -r; i <= r; i++)
+			for (j = -r; j <= r; j++)
+				if (i * i + j * j <= r * r + 1)
+					pset(c, x + i, y + j, COL_FG);
+		text(c, x + FONT_W * c->fs / 2 + r,
+		     y - FONT_H * c->fs - r, l->text, COL_FG, 0);
+	}
+}
+
+/**
+ * plot_style() - data style from its gnuplot name
+ * @name:	"lines", "points", ...
+ *
+ * Returns one of PLOT_*; unknown names give points, gnuplot's default.
+ **/
+int plot_style(const char *name)
+{
+	static const char *names[] = {
+		"linespoints", "points", "dots", "lines", "impulses",
+		"fsteps", "histeps", "boxes", "steps",
+	};
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+
+	return PLOT_POINTS;
+}
+
+/**
+ * plot_png() - render a plot into a PNG file
+ * @p:		traces, labels and options
+ * @filename:	output file
+ *
+ * Traces are drawn in order over the grid, with the border, key and
+ * labels on top. Points outside a fixed x range don't take part in
+ * autoscaling the y axis.
+ *
+ * Returns 0 on success or a negative errno.
+ **/
+int plot_png(const s_plot * p, const char *filename)
+{
+	struct canvas c;
+	struct axis ax, ay;
+	double xlo, xhi, ylo, yhi, u, tick[MAX_TICKS];
+	char s[32];
+	int fixlo, fixhi, i, n, wmax = 0, ret;
+	unsigned k;
+
+	if (p->w < 64 || p->h < 64)
+		return -EINVAL;
+
+	memset(&c, 0, sizeof(c));
+	c.w = p->w;
+	c.h = p->h;
+	c.fs = p->h >= 2 * PLOT_H ? 2 : 1;
+	c.pix = calloc(c.w, c.h);
+	if (c.pix == NULL)
+		return -ENOMEM;
+
+	memset(&ax, 0, sizeof(ax));
+	memset(&ay, 0, sizeof(ay));
+	ax.log = p->logx;
+	ay.log = p->logy;
+
+	plot_extents(p, &ax, &ay, &xlo, &xhi, &ylo, &yhi);
+
+	fixlo = axis_value(&ax, p->xmin, &u);
+	if (fixlo)
+		xlo = u;
+	fixhi = axis_value(&ax, p->xmax, &u);
+	if (fixhi)
+		xhi = u;
+
+	axis_fit(&ay, ylo, yhi, 0, 0, p->ytics, p->h / 60);
+
+	/* room for the y tic labels and the ylabel */
+	n = axis_ticks(&ay, tick);
+	for (i = 0; i < n; i++) {
+		tick_label(s, sizeof(s), &ay, tick[i]);
+		wmax = text_width(&c, s) > wmax ? text_width(&c, s) : wmax;
+	}
+
+	c.left = wmax + (p->ylabel[0] ? 2 * FONT_H : FONT_H) * c.fs + 8;
+	c.top = FONT_H * c.fs;
+	c.right = c.w - 1 - 4 * FONT_W * c.fs;
+	c.bottom = c.h - 1 - (3 * FONT_H + 4) * c.fs;
+
+	axis_fit(&ax, xlo, xhi, fixlo, fixhi, 0, (c.right - c.left) / 80);
+
+	plot_axes(&c, p, &ax, &ay);
+
+	for (k = 0; k < p->ntraces; k++)
+		plot_trace_draw(&c, p, &p->trace[k], &ax, &ay,
+				trace_colors[(p->color + k) % sizeof(trace_colors)]);
+
+	line(&c, c.left, c.top, c.right, c.top, COL_FG);
+	line(&c, c.left, c.bottom, c.right, c.bottom, COL_FG);
+	line(&c, c.left, c.top, c.left, c.bottom, COL_FG);
+	line(&c, c.right, c.top, c.right, c.bottom, COL_FG);
+
+	plot_key(&c, p);
+	plot_labels(&c, p, &ax, &ay);
+
+	text(&c, (c.left + c.right - text_width(&c, p->xlabel)) / 2,
+	     c.h - 1 - (FONT_H + 2) * c.fs, p->xlabel, COL_FG, 0);
+	text(&c, 2 * c.fs, (c.top + c.bottom + text_width(&c, p->ylabel)) / 2,
+	     p->ylabel, COL_FG, 1);
+
+	ret = image_write_png(filename, c.pix, c.w, c.h, plot_palette, NCOLORS);
+
+	free(c.pix);
+
+	return ret < 0 ? -EIO : 0;
+}
+
+/*
+ * Display reduction. Beyond two values per pixel column a trace draws
+ * over itself, so it is replaced by the minimum and maximum of each
+ * column of the visible x range, in the order they rise or fall. The
+ * extremes, and with them the y autoscale, are kept; the renderer's
+ * work depends on the image width instead of the capture depth.
+ */
+/*
+ * Eight lanes, one pass: independent minima and maxima the compiler can
+ * keep in vector registers, merged at the end.
+ */
+#define LANES	8
+
+static inline void minmax_s(const short *s, unsigned stride, unsigned n,
+			    float *lo, float *hi)
+{
+	short l[LANES], h[LANES], v;
+	unsigned i, j;
+
+	for (j = 0; j < LANES; j++)
+		l[j] = h[j] = s[0];
+
+	for (i = 0; i + LANES <= n; i += LANES)
+		for (j = 0; j < LANES; j++) {
+			v = s[(i + j) * stride];
+			l[j] = v < l[j] ? v : l[j];
+			h[j] = v > h[j] ? v : h[j];
+		}
+	for (; i < n; i++) {
+		v = s[i * stride];
+		l[0] = v < l[0] ? v : l[0];
+		h[0] = v > h[0] ? v : h[0];
+	}
+
+	for (j = 1; j < LANES; j++) {
+		l[0] = l[j] < l[0] ? l[j] : l[0];
+		h[0] = h[j] > h[0] ? h[j] : h[0];
+	}
+	*lo = l[0];
+	*hi = h[0];
+}
+
+/* NaN compares false, so gaps drop out; an all gap column stays one */
+static void minmax_f(const float *f, unsigned n, float *lo, float *hi)
+{
+	float l[LANES], h[LANES], v;
+	unsigned i, j;
+
+	for (j = 0; j < LANES; j++) {
+		l[j] = INFINITY;
+		h[j] = -INFINITY;
+	}
+
+	for (i = 0; i + LANES <= n; i += LANES)
+		for (j = 0; j < LANES; j++) {
+			v = f[i + j];
+			l[j] = v < l[j] ? v : l[j];
+			h[j] = v > h[j] ? v : h[j];
+		}
+	for (; i < n; i++) {
+		v = f[i];
+		l[0] = v < l[0] ? v : l[0];
+		h[0] = v > h[0] ? v : h[0];
+	}
+
+	for (j = 1; j < LANES; j++) {
+		l[0] = l[j] < l[0] ? l[j] : l[0];
+		h[0] = h[j] > h[0] ? h[j] : h[0];
+	}
+	*lo = l[0] <= h[0] ? l[0] : NAN;
+	*hi = l[0] <= h[0] ? h[0] : NAN;
+}
+
+static void plot_reduce_trace(plot_trace * t, float *out, unsigned cols,
+			      double xmin, double xmax)
+{
+	double lo = t->x0, hi = t->x0 + (t->n - 1.0) * t->dx, step;
+	unsigned long long span;
+	unsigned c, a, b, i0, i1;
+	float l, h, first, last;
+
+	if (isfinite(xmin) && xmin > lo)
+		lo = xmin;
+	if (isfinite(xmax) && xmax < hi)
+		hi = xmax;
+	if (!(t->dx > 0) || !(hi > lo))
+		return;
+
+	i0 = ceil((lo - t->x0) / t->dx);
+	i1 = floor((hi - t->x0) / t->dx) + 1;
+	if (i1 > t->n)
+		i1 = t->n;
+	if (i1 <= i0 || i1 - i0 <= 2 * cols)
+		return;
+	span = i1 - i0;
+
+	for (c = 0, b = i0; c < cols; c++) {
+		a = b;
+		b = i0 + span * (c + 1) / cols;
+		if (t->s) {
+			/* constant strides for the common cases, see minmax_s() */
+			if (t->stride == 1)
+				minmax_s(t->s + a, 1, b - a, &l, &h);
+			else if (t->stride == 2)
+				minmax_s(t->s + 2 * a, 2, b - a, &l, &h);
+			else
+				minmax_s(t->s + a * t->stride, t->stride, b - a,
+					 &l, &h);
+			first = t->s[a * t->stride];
+			last = t->s[(b - 1) * t->stride];
+		} else {
+			minmax_f(t->f + a, b - a, &l, &h);
+			first = t->f[a];
+			last = t->f[b - 1];
+		}
+		out[2 * c] = first > last ? h : l;
+		out[2 * c + 1] = first > last ? l : h;
+	}
+
+	/* two values a column, at its quarters */
+	step = (double)span / cols * t->dx;
+	t->x0 += (i0 - 0.5) * t->dx + step / 4;
+	t->dx = step / 2;
+	t->s = NULL;
+	t->f = out;
+	t->stride = 1;
+	t->n = 2 * cols;
+}
+
+/**
+ * plot_reduce() - reduce the traces to the image resolution
+ * @p:		traces and options, from plot_options() and plot_traces()
+ * @all:	the points and dots styles too
+ *
+ * Traces with more than two values per pixel column within the x range
+ * become a min/max pair per column, in p->reduced. Log x scales keep
+ * the full traces, their columns aren't evenly spaced in x, and unless
+ * @all so do the points and dots styles, which show the spread within
+ * a column.
+ **/
+void plot_reduce(s_plot * p, int all)
+{
+	unsigned k, cols = p->w < PLOT_REDUCED / 2 ? p->w : PLOT_REDUCED / 2;
+
+	if (p->logx || cols == 0 ||
+	    (!all && (p->style == PLOT_POINTS || p->style == PLOT_DOTS)))
+		return;
+
+	for (k = 0; k < p->ntraces; k++)
+		plot_reduce_trace(&p->trace[k], p->reduced[k], cols,
+				  p->xmin, p->xmax);
+}
+
+static int plot_time(s_info * info, s_plot * p, char **postvars)
+{
+	s_capture *cap;
+	plot_trace *t;
+	double shift = 0;
+	unsigned b, c;
+
+	if (info->svertical.vdiv && postvars[info->svertical.vdiv][0] != 'X')
+		p->ytics = atof(postvars[info->svertical.vdiv]);
+
+	snprintf(p->xlabel, sizeof(p->xlabel), "%d Samples @ %d Samples/s    t->",
+		 info->stime_s.samples, info->stime_s.sps);
+	strcpy(p->ylabel, "ADC Values");
+
+	/* moves the lagging trace back onto the first one */
+	if (info->sdisplay.align && info->scorr.valid)
+		shift = -info->scorr.delay;
+
+	for (b = 0; b < (info->has_slave ? 2 : 1); b++) {
+		cap = &info->scapture[b];
+		if (cap->data == NULL)
+			continue;
+		for (c = 0; c < 2; c++) {
+			if (!(info->channel_en_mask & (1 << c)))
+				continue;
+			t = &p->trace[p->ntraces++];
+			t->s = cap->data + (c < cap->samples_per_scan ? c : 0);
+			t->stride = cap->samples_per_scan;
+			t->n = cap->samples;
+			t->dx = 1;
+			if (info->has_slave) {
+				t->x0 = b ? shift : 0;
+				snprintf(t->title, sizeof(t->title), "%s_CH%u",
+					 b ? "HPC" : "LPC", c);
+			} else {
+				t->x0 = (c && info->channel_en_mask == 3) ? shift : 0;
+				snprintf(t->title, sizeof(t->title), "ch%u", c);
+			}
+		}
+	}
+
+	return p->ntraces ? 0 : -EINVAL;
+}
+
+static int plot_spectrum(s_info * info, s_plot * p)
+{
+	s_spectrum *sp;
+	s_markers *mk;
+	plot_trace *t;
+	double dx = 1;
+	unsigned b, i, h, nb = info->has_slave ? 2 : 1;
+
+	if (info->sdisplay.fftscaled)
+		dx = (double)info->stime_s.sps / info->stime_s.samples;
+
+	snprintf(p->xlabel, sizeof(p->xlabel), "%d point %sFFT @ %d Samples/s    %s",
+		 info->stime_s.samples, info->sdisplay.iq ? "I/Q " : "",
+		 info->stime_s.sps, info->sdisplay.fftscaled ? "f/Hz->" : "f->");
+	strcpy(p->ylabel, "Magnitude in dB");
+
+	/* the spectra first, then the held traces */
+	for (h = 0; h < 2; h++)
+		for (b = 0; b < nb; b++) {
+			sp = &info->sspectrum[b];
+			if (sp->db == NULL || (h && sp->hold == NULL))
+				continue;
+			/* a gap, as the text file leaves DC out */
+			if (info->sdisplay.fftexludezero && sp->k0 <= 0 &&
+			    -sp->k0 < (int)sp->n)
+				(h ? sp->hold : sp->db)[-sp->k0] = NAN;
+			t = &p->trace[p->ntraces++];
+			t->f = h ? sp->hold : sp->db;
+			t->n = sp->n;
+			t->x0 = sp->k0 * dx;
+			t->dx = dx;
+			if (h)
+				snprintf(t->title, sizeof(t->title), "%s%s",
+					 info->has_slave ? (b ? "HPC " : "LPC ") : "",
+					 trace_name(info));
+			else
+				strcpy(t->title, info->has_slave ?
+				       (b ? "HPC" : "LPC") : "FFT");
+		}
+
+	for (b = 0; b < nb; b++) {
+		mk = &info->smarkers[b];
+		for (i = 0; i < mk->n && p->nlabels < PLOT_LABELS; i++) {
+			p->label[p->nlabels].x = info->sdisplay.fftscaled ?
+				mk->peak[i].freq : mk->peak[i].bin;
+			p->label[p->nlabels].y = mk->peak[i].db;
+			snprintf(p->label[p->nlabels].text,
+				 sizeof(p->label[0].text), "%sM%u",
+				 b ? "H" : "", i + 1);
+			p->nlabels++;
+		}
+	}
+
+	return p->ntraces ? 0 : -EINVAL;
+}
+
+/**
+ * plot_traces() - traces, labels and axis titles of the display
+ * @info:	settings, the retained captures and spectra
+ * @p:		filled in, the options are left alone
+ * @postvars:	request, for the ytics
+ *
+ * Only for the displays plot_retained() is true for.
+ * Returns 0 on success, -EINVAL if there is nothing to draw.
+ **/
+int plot_traces(s_info * info, s_plot * p, char **postvars)
+{
+	if (info->sdisplay.tdom)
+		return plot_time(info, p, postvars);
+
+	return plot_spectrum(info, p);
+}
+
+/**
+ * plot_retained() - is the display drawn from retained data
+ * @info:	settings
+ *
+ * True for the time domain and the software FFT, whose traces are in
+ * scapture[] and sspectrum[]; the other displays only exist as text.
+ **/
+int plot_retained(s_info * info)
+{
+	return info->sdisplay.tdom ||
+	       !(info->sdisplay.cross || info->sdisplay.zoom ||
+		 info->sdisplay.waterfall || info->sdisplay.hw_fft);
+}
+
+/**
+ * plot_options() - plot options of the request
+ * @info:	settings
+ * @p:		filled in
+ * @postvars:	request
+ *
+ * The options of the gnuplot script: grid, zero axis, data style,
+ * colour, log scales, x range and size ratio, which scales the image.
+ **/
+void plot_options(s_info * info, s_plot * p, char **postvars)
+{
+	const char *s;
+	double r = 1;
+
+	if (info->sdisplay.size_ratio)
+		r = atof(postvars[info->sdisplay.size_ratio]);
+	r = r < 0.25 ? 0.25 : (r > MAXSIZERATIO ? MAXSIZERATIO : r);
+	p->w = PLOT_W * r;
+	p->h = PLOT_H * r;
+
+	p->grid = info->sdisplay.set_grid;
+	p->zeroaxis = info->sdisplay.axis;
+	p->style = info->sdisplay.style ?
+		plot_style(postvars[info->sdisplay.style]) : PLOT_POINTS;
+	if (info->sdisplay.color && atoi(postvars[info->sdisplay.color]) > 0)
+		p->color = atoi(postvars[info->sdisplay.color]) - 1;
+
+	if (info->sdisplay.logscale) {
+		s = postvars[info->sdisplay.logscale];
+		if (strncmp(s, "logscale", 8) == 0) {
+			p->logx = strchr(s + 8, 'x') != NULL;
+			p->logy = strchr(s + 8, 'y') != NULL;
+		}
+	}
+
+	p->xmin = p->xmax = NAN;
+	if (info->sdisplay.xrange && postvars[info->sdisplay.xrange][0] != '*')
+		p->xmin = atof(postvars[info->sdisplay.xrange]);
+	if (info->sdisplay.xrange1 && postvars[info->sdisplay.xrange1][0] != '*')
+		p->xmax = atof(postvars[info->sdisplay.xrange1]);
+}
+
+/**
+ * plot_render() - draw the acquired traces into the session image
+ * @info:	settings, the retained captures and spectra
+ * @postvars:	request, for the plot options
+ *
+ * Draws the time domain and the software FFT displays, with the same
+ * options as the gnuplot script, see plot_options(), and the traces
+ * reduced to the image width.
+ *
+ * Returns 0 on success, -ENOSYS for displays left to gnuplot, or
+ * another negative errno.
+ **/
+int plot_render(s_info * info, char **postvars)
+{
+	s_plot *p;
+	int ret;
+
+	if (!plot_retained(info))
+		return -ENOSYS;
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		return -ENOMEM;
+
+	plot_options(info, p, postvars);
+
+	ret = plot_traces(info, p, postvars);
+	if (ret == 0) {
+		plot_reduce(p, 0);
+		ret = plot_png(p, info->pFILENAME_IMG);
+	}
+
+	free(p);
+
+	return ret;
+}
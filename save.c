@@ -0,0 +1,203 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Binary capture files, the default "Acquire Save" format: the raw
+ * samples of the enabled channels behind a small header, which has what
+ * is needed to read them back. Little endian throughout:
+ *
+ *   0  char[8]  "NDSOCAP1"
+ *   8  u32      header size, the samples start there
+ *  12  u32      sample rate, Hz
+ *  16  u32      samples per channel
+ *  20  u16      channels per sample, interleaved
+ *  22  u16      boards, LPC then HPC, one block of samples each
+ *  24  u32      channel mask, bit n set if ADC channel n is in the file
+ *  28  f32      scale, full scale fraction per code
+ *  32  s32      offset, code of 0 V, subtracted before scaling
+ *  36  u16      bits per sample, signed
+ *  38  u16      reserved
+ *  40  char[32] device, NUL padded
+ *  72  char[32] slave device, empty without one
+ *
+ * Per board, samples * channels s16 values follow.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define SAVE_MAGIC	"NDSOCAP1"
+#define SAVE_HEADER	104
+#define SAVE_BUF	65536	/* bytes per fwrite() */
+
+static void save_header(unsigned char *h, s_info * info, unsigned mask,
+			unsigned channels, unsigned boards,
+			const char *device, const char *slave)
+{
+	union {
+		float f;
+		uint32_t u;
+	} scale;
+
+	memset(h, 0, SAVE_HEADER);
+	memcpy(h, SAVE_MAGIC, 8);
+	put_le32(h + 8, SAVE_HEADER);
+	put_le32(h + 12, info->stime_s.sps);
+	put_le32(h + 16, info->scapture[0].samples);
+	put_le16(h + 20, channels);
+	put_le16(h + 22, boards);
+	put_le32(h + 24, mask);
+	scale.f = 1 / ADC_FULL_SCALE;
+	put_le32(h + 28, scale.u);
+	put_le32(h + 32, BINARY_OFFSET);
+	put_le16(h + 36, 16);
+	if (device)
+		strncpy((char *)h + 40, device, 31);
+	if (slave && boards > 1)
+		strncpy((char *)h + 72, slave, 31);
+}
+
+/**
+ * save_layout() - what goes into a capture file
+ * @info:	settings and scapture[]
+ * @mask:	channels of each board, the enabled ones
+ * @boards:	1, or 2 with a slave capture of the same length
+ *
+ * The binary and SigMF formats both hold these channels of these boards.
+ * Returns the channels per board, 0 if there's nothing to save.
+ **/
+unsigned save_layout(s_info * info, unsigned *mask, unsigned *boards)
+{
+	unsigned n = info->scapture[0].samples;
+
+	*mask = info->channel_en_mask & 3;
+	*boards = (info->has_slave && info->scapture[1].data &&
+		   info->scapture[1].samples == n) ? 2 : 1;
+	if (info->scapture[0].data == NULL)
+		return 0;
+
+	return (*mask & 1) + (*mask >> 1);
+}
+
+/**
+ * save_capture() - write the retained captures as a binary capture file
+ * @info:	settings and scapture[]
+ * @out:	output
+ * @device:	device name, for the header
+ * @slave:	slave device name, or NULL
+ *
+ * Only the enabled channels are written, as they were captured; the
+ * header gives the scale and offset to apply.
+ *
+ * Returns the number of bytes written or a negative errno.
+ **/
+int save_capture(s_info * info, FILE * out, const char *device,
+		 const char *slave)
+{
+	unsigned mask, channels, boards, n;
+	unsigned b, c, i, len;
+	unsigned char *buf;
+	const short *d;
+	s_capture *cap;
+	int total = 0;
+
+	n = info->scapture[0].samples;
+	channels = save_layout(info, &mask, &boards);
+	if (channels == 0)
+		return -EINVAL;
+
+	buf = malloc(SAVE_BUF);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	save_header(buf, info, mask, channels, boards, device, slave);
+	len = SAVE_HEADER;
+
+	for (b = 0; b < boards; b++) {
+		cap = &info->scapture[b];
+		for (i = 0; i < n; i++) {
+			for (c = 0; c < 2; c++) {
+				if (!(mask & (1 << c)))
+					continue;
+				d = cap->data + i * cap->samples_per_scan;
+				put_le16(buf + len,
+					 d[c < cap->samples_per_scan ? c : 0]);
+				len += 2;
+			}
+			if (len > SAVE_BUF - 4) {
+				total += fwrite(buf, 1, len, out);
+				len = 0;
+			}
+		}
+	}
+	total += fwrite(buf, 1, len, out);
+
+	free(buf);
+
+	return ferror(out) ? -EIO : total;
+}
+
+/**
+ * save_store() - keep the capture as the file of an "Acquire Save"
+ * @info:	settings and scapture[]
+ * @path:	file, in the format of save_fmt
+ * @device:	device name
+ * @slave:	slave device name, or NULL
+ *
+ * The download goes out from this file, and a download resumed by a
+ * Range request continues it rather than a new capture. Its time is
+ * that of the capture, which download_file() makes the validator.
+ *
+ * Returns 0 on success or a negative errno, -EINVAL without a capture.
+ **/
+int save_store(s_info * info, const char *path, const char *device,
+	       const char *slave)
+{
+	struct timeval tv[2];
+	char name[64];
+	FILE *out;
+	int ret;
+
+	if (info->scapture[0].data == NULL)
+		return -EINVAL;
+
+	if (info->sdisplay.save_fmt == SAVE_TEXT) {
+		/* iio_sample() has written it */
+		if (rename(info->pFILENAME_T_OUT, path) < 0)
+			return -errno;
+	} else {
+		out = fopen(path, "w");
+		if (out == NULL)
+			return -errno;
+		if (info->sdisplay.save_fmt == SAVE_SIGMF) {
+			snprintf(name, sizeof(name), "capture_%s",
+				 info->pREMOTE_ADDR);
+			ret = sigmf_write(info, out, name, device, slave);
+		} else {
+			ret = save_capture(info, out, device, slave);
+		}
+		if (fclose(out) && ret >= 0)
+			ret = -EIO;
+		if (ret < 0) {
+			unlink(path);
+			return ret;
+		}
+	}
+
+	if (info->scapture[0].time > 0) {
+		tv[0].tv_sec = info->scapture[0].time;
+		tv[0].tv_usec = (info->scapture[0].time - tv[0].tv_sec) * 1e6;
+		tv[1] = tv[0];
+		utimes(path, tv);
+	}
+
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * SigMF capture files (SF=2 with "Acquire Save"), for the offline tools
+ * reading SigMF. A download is a single file, so the recording goes out
+ * as a SigMF archive, a tar file holding <name>/<name>.sigmf-meta and
+ * <name>/<name>.sigmf-data. The data are the enabled channels, ri16_le
+ * codes with the offset of 0 V removed, interleaved per sample, those
+ * of a slave board after the master's. The metadata have the sample
+ * rate, the devices, the capture time and, in the "ndso" extension, the
+ * scale to full scale and the channel names.
+ *
+ * The metadata are small and formatted first; the samples are written
+ * as they are converted, SIGMF_BUF bytes at a time, so the archive is
+ * never in memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define SIGMF_META	4096
+#define SIGMF_BUF	65536	/* bytes per fwrite() */
+#define TAR_BLOCK	512
+
+static const char *sigmf_board[] = { "LPC ", "HPC " };
+
+/* device names go into JSON strings as they are, quotes excepted */
+static void sigmf_name(char *dst, unsigned size, const char *src)
+{
+	unsigned i;
+
+	for (i = 0; src && src[i] && i < size - 1; i++)
+		dst[i] = (src[i] == '"' || src[i] == '\\' ||
+			  (unsigned char)src[i] < ' ') ? '_' : src[i];
+	dst[i] = 0;
+}
+
+/* the .sigmf-meta file, returns its length or -ENOSPC */
+static int sigmf_meta(s_info * info, char *buf, const char *device,
+		      const char *slave)
+{
+	unsigned mask, boards, channels, b, c, k = 0;
+	char dev[64], sdev[64], date[40] = "";
+	int len;
+
+	channels = save_layout(info, &mask, &boards);
+	sigmf_name(dev, sizeof(dev), device);
+	sigmf_name(sdev, sizeof(sdev), boards > 1 ? slave : NULL);
+
+	if (info->scapture[0].time > 0) {
+		time_t t = info->scapture[0].time;
+		struct tm tm;
+
+		gmtime_r(&t, &tm);
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+		snprintf(date + strlen(date), sizeof(date) - strlen(date),
+			 ".%06uZ", (unsigned)((info->scapture[0].time - t) * 1e6));
+	}
+
+	len = snprintf(buf, SIGMF_META,
+		       "{\n  \"global\": {\n"
+		       "    \"core:datatype\": \"ri16_le\",\n"
+		       "    \"core:sample_rate\": %u,\n"
+		       "    \"core:num_channels\": %u,\n"
+		       "    \"core:version\": \"1.0.0\",\n"
+		       "    \"core:hw\": \"%s%s%s\",\n"
+		       "    \"core:recorder\": \"ndso\",\n"
+		       "    \"core:extensions\": [{\"name\": \"ndso\", \"version\": \"1.0.0\", \"optional\": true}],\n"
+		       "    \"ndso:scale\": %.17g,\n"
+		       "    \"ndso:channels\": [",
+		       info->stime_s.sps, channels * boards, dev,
+		       sdev[0] ? ", " : "", sdev, 1 / ADC_FULL_SCALE);
+
+	for (b = 0; b < boards; b++)
+		for (c = 0; c < 2; c++)
+			if (mask & (1 << c))
+				len += snprintf(buf + len, SIGMF_META - len,
+						"%s\"%svoltage%u\"",
+						k++ ? ", " : "",
+						boards > 1 ? sigmf_board[b] : "", c);
+
+	/* real samples from DC, the ADC samples directly */
+	len += snprintf(buf + len, SIGMF_META - len,
+			"]\n  },\n  \"captures\": [{\n"
+			"    \"core:sample_start\": 0,\n"
+			"    \"core:frequency\": 0%s%s%s\n"
+			"  }],\n  \"annotations\": []\n}\n",
+			date[0] ? ",\n    \"core:datetime\": \"" : "", date,
+			date[0] ? "\"" : "");
+
+	return len < SIGMF_META ? len : -ENOSPC;
+}
+
+static long long sigmf_data_size(s_info * info)
+{
+	unsigned mask, boards, channels;
+
+	channels = save_layout(info, &mask, &boards);
+
+	return 2LL * boards * channels * info->scapture[0].samples;
+}
+
+static long long tar_padded(long long len)
+{
+	return (len + TAR_BLOCK - 1) & ~(long long)(TAR_BLOCK - 1);
+}
+
+/* ustar header of a file <dir>/<dir><ext> */
+static void tar_header(unsigned char *h, const char *dir, const char *ext,
+		       long long size, time_t mtime)
+{
+	unsigned sum = 0, i;
+
+	memset(h, 0, TAR_BLOCK);
+	snprintf((char *)h, 100, "%s%s", dir, ext);
+	strcpy((char *)h + 100, "0000644");
+	strcpy((char *)h + 108, "0000000");
+	strcpy((char *)h + 116, "0000000");
+	snprintf((char *)h + 124, 12, "%011llo", size);
+	snprintf((char *)h + 136, 12, "%011llo", (long long)mtime);
+	memset(h + 148, ' ', 8);
+	h[156] = '0';
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	snprintf((char *)h + 345, 155, "%s", dir);
+
+	for (i = 0; i < TAR_BLOCK; i++)
+		sum += h[i];
+	snprintf((char *)h + 148, 8, "%06o", sum);
+}
+
+/**
+ * sigmf_write() - write the retained captures as a SigMF archive
+ * @info:	settings and scapture[]
+ * @out:	output
+ * @name:	recording name, the archive's directory and file names
+ * @device:	device name
+ * @slave:	slave device name, or NULL
+ *
+ * The files in the archive have the time of the capture.
+ *
+ * Returns the number of bytes written or a negative errno.
+ **/
+int sigmf_write(s_info * info, FILE * out, const char *name,
+		const char *device, const char *slave)
+{
+	unsigned mask, channels, boards, n;
+	unsigned b, c, i, len;
+	unsigned char *buf;
+	long long size;
+	const short *d;
+	s_capture *cap;
+	time_t mtime = info->scapture[0].time;
+	int meta, total = 0;
+
+	n = info->scapture[0].samples;
+	channels = save_layout(info, &mask, &boards);
+	if (channels == 0)
+		return -EINVAL;
+
+	/* the metadata fit the buffer, behind their header */
+	buf = malloc(SIGMF_BUF);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	meta = sigmf_meta(info, (char *)buf + TAR_BLOCK, device, slave);
+	if (meta < 0) {
+		free(buf);
+		return meta;
+	}
+	tar_header(buf, name, ".sigmf-meta", meta, mtime);
+	len = TAR_BLOCK + tar_padded(meta);
+	memset(buf + TAR_BLOCK + meta, 0, len - TAR_BLOCK - meta);
+
+	size = sigmf_data_size(info);
+	tar_header(buf + len, name, ".sigmf-data", size, mtime);
+	len += TAR_BLOCK;
+
+	for (i = 0; i < n; i++) {
+		for (b = 0; b < boards; b++) {
+			cap = &info->scapture[b];
+			d = cap->data + i * cap->samples_per_scan;
+			for (c = 0; c < 2; c++) {
+				if (!(mask & (1 << c)))
+					continue;
+				put_le16(buf + len,
+					 d[c < cap->samples_per_scan ? c : 0] -
+					 BINARY_OFFSET);
+				len += 2;
+			}
+		}
+		if (len > SIGMF_BUF - 8) {
+			total += fwrite(buf, 1, len, out);
+			len = 0;
+		}
+	}
+
+	/* padding of the data, then the end of the archive */
+	if (len > SIGMF_BUF - 3 * TAR_BLOCK) {
+		total += fwrite(buf, 1, len, out);
+		len = 0;
+	}
+	memset(buf + len, 0, tar_padded(size) - size + 2 * TAR_BLOCK);
+	len += tar_padded(size) - size + 2 * TAR_BLOCK;
+	total += fwrite(buf, 1, len, out);
+
+	free(buf);
+
+	return ferror(out) ? -EIO : total;
+}
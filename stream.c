@@ -0,0 +1,224 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Live view ("BL" request key, with the usual form fields): one long
+ * response carrying a frame per capture, for as long as the client
+ * reads it. thttpd runs CGIs behind a pipe and can't hand them an
+ * upgraded (WebSocket) connection, so the frames go down the plain
+ * response instead; fetch() reads them as they come. Each frame is a
+ * data_frame(), length first: the traces reduced to the image width,
+ * time domain or spectrum as the form selects. Its header also has
+ * "seq", counting captures, and "dropped". A client too slow to take a
+ * frame misses it: a frame is only started once the one before has
+ * left the pipe, otherwise it is dropped, never queued; one larger than
+ * the pipe is written as the client reads it. The stream ends once the
+ * client is gone, or hasn't read for TIMEOUT seconds.
+ *
+ * Measurements ("BM" request key) go the same way, as Server-Sent
+ * Events for EventSource: an event "measure" per capture with the
+ * data_measure() JSON, its id the capture count, formatted into the
+ * same buffer every time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define STREAM_FPS	25	/* frame rate limit, without LR */
+#define STREAM_EVENT	8192	/* measurement event */
+
+static double stream_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* the previous frame has left the pipe, if it tells */
+static int stream_room(int fd)
+{
+	int queued;
+
+	if (ioctl(fd, FIONREAD, &queued) < 0)
+		return 1;
+
+	return queued == 0;
+}
+
+/*
+ * Returns 1 if the frame went out, 0 if it was dropped, or a negative
+ * errno once the client is gone.
+ */
+static int stream_write(int fd, const unsigned char *buf, unsigned len)
+{
+	struct pollfd pfd = { fd, POLLOUT, 0 };
+	unsigned done = 0;
+	ssize_t n;
+
+	if (!stream_room(fd))
+		return 0;
+
+	while (done < len) {
+		n = write(fd, buf + done, len - done);
+		if (n > 0) {
+			done += n;
+			continue;
+		}
+		if (n < 0 && errno != EAGAIN && errno != EINTR)
+			return -errno;
+		/* nothing of it out yet, so drop it */
+		if (done == 0)
+			return 0;
+		/* a started frame has to be finished, or the stream breaks */
+		n = poll(&pfd, 1, TIMEOUT * 1000);
+		if (n <= 0)
+			return -ETIMEDOUT;
+		if (pfd.revents & (POLLERR | POLLHUP))
+			return -EPIPE;
+	}
+
+	return 1;
+}
+
+static int stream_frame(s_info * info, char **postvars, s_plot * p,
+			const char *extra, unsigned char **buf, unsigned *size)
+{
+	int ret;
+
+	memset(p, 0, sizeof(*p));
+	plot_options(info, p, postvars);
+	ret = plot_traces(info, p, postvars);
+	if (ret < 0)
+		return ret;
+	plot_reduce(p, 1);
+
+	return data_frame(info, p, extra, buf, size);
+}
+
+static int stream_event(s_info * info, unsigned seq, const char *extra,
+			unsigned char *buf)
+{
+	int len, n;
+
+	len = sprintf((char *)buf, "id: %u\nevent: measure\ndata: ", seq);
+	n = data_measure(info, extra, (char *)buf + len, STREAM_EVENT - len - 2);
+	if (n < 0)
+		return n;
+	len += n;
+	buf[len++] = '\n';
+	buf[len++] = '\n';
+
+	return len;
+}
+
+/**
+ * stream_run() - send a frame per capture until the client goes away
+ * @form_method:	request, for iio_sample()
+ * @getvars:		request
+ * @postvars:		request, the plot options apply to the frames
+ * @info:		settings, get_sample_freq() has run
+ *
+ * Frames for LIVE requests, measurement events for MEASURE ones. The
+ * captures take the time they take, LR (frames per second) only limits
+ * the rate for short ones.
+ *
+ * Returns 0 once the client is gone, or a negative errno.
+ **/
+int stream_run(int form_method, char **getvars, char **postvars,
+	       s_info * info)
+{
+	unsigned char *buf = NULL;
+	unsigned size = 0, seq, dropped = 0;
+	double period, next, sent, t;
+	char extra[48];
+	s_plot *p = NULL;
+	int n, ret = 0;
+
+	if (info->run == MEASURE) {
+		size = STREAM_EVENT;
+		buf = malloc(size);
+		if (buf == NULL)
+			return -ENOMEM;
+		printf("Content-type: text/event-stream\n");
+		printf("Cache-Control: no-cache\n\n");
+		/* EventSource reconnects after a second */
+		printf("retry: 1000\n\n");
+	} else {
+		if (!plot_retained(info))
+			return -EINVAL;
+		p = malloc(sizeof(*p));
+		if (p == NULL)
+			return -ENOMEM;
+		printf("Content-type: application/octet-stream\n");
+		printf("Cache-Control: no-cache\n\n");
+	}
+	fflush(stdout);
+
+	/* a closed connection shows up as a write error */
+	signal(SIGPIPE, SIG_IGN);
+	fcntl(1, F_SETFL, fcntl(1, F_GETFL) | O_NONBLOCK);
+
+	period = 1.0 / (info->sdisplay.live_fps ? info->sdisplay.live_fps : STREAM_FPS);
+	next = sent = stream_now();
+
+	for (seq = 0; ; seq++) {
+		ret = iio_sample(form_method, getvars, postvars, info,
+				 postvars[info->sinput.device],
+				 (info->sinput.slaveadc == 0xFFFF) ?
+				 NULL : postvars[info->sinput.slaveadc]);
+		if (ret < 0)
+			break;
+		/* a frame without them rather than no stream */
+		capture_results(info, NULL);
+
+		snprintf(extra, sizeof(extra), "\"seq\":%u,\"dropped\":%u,",
+			 seq, dropped);
+		if (p)
+			n = stream_frame(info, postvars, p, extra, &buf, &size);
+		else
+			n = stream_event(info, seq, extra, buf);
+		if (n < 0) {
+			ret = n;
+			break;
+		}
+
+		ret = stream_write(1, buf, n);
+		if (ret < 0)
+			break;
+		t = stream_now();
+		if (ret) {
+			sent = t;
+		} else {
+			dropped++;
+			if (t - sent > TIMEOUT)
+				break;
+		}
+
+		next += period;
+		if (next > t)
+			usleep((next - t) * 1e6);
+		else
+			next = t;
+	}
+
+	free(buf);
+	free(p);
+
+	/* the client closing the stream is how it ends */
+	return ret == -EPIPE || ret == -ECONNRESET ? 0 : ret;
+}
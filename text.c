@@ -0,0 +1,217 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Batched number formatting for the gnuplot data files, which have a
+ * line per sample or bin. Values are formatted into a large buffer,
+ * integers two digits at a time from a table, fixed point values by
+ * scaling to an integer, and written out with one fwrite() per buffer
+ * instead of one fprintf() per value. The output is the same as with
+ * the "%d", "%lld" and "%.<n>f" formats.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define TEXT_MAX	48	/* longest value, with sign, point and separator */
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const double pow10_tab[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+};
+
+/* digits of v, written backwards from end */
+static char *text_u64(char *end, unsigned long long v)
+{
+	const char *d;
+
+	while (v >= 100) {
+		d = digit_pairs + 2 * (v % 100);
+		v /= 100;
+		*--end = d[1];
+		*--end = d[0];
+	}
+	if (v >= 10) {
+		d = digit_pairs + 2 * v;
+		*--end = d[1];
+		*--end = d[0];
+	} else {
+		*--end = '0' + v;
+	}
+
+	return end;
+}
+
+/* exactly n digits of v, zero padded */
+static char *text_u64_pad(char *end, unsigned long long v, unsigned n)
+{
+	const char *d;
+
+	for (; n >= 2; n -= 2) {
+		d = digit_pairs + 2 * (v % 100);
+		v /= 100;
+		*--end = d[1];
+		*--end = d[0];
+	}
+	if (n)
+		*--end = '0' + v % 10;
+
+	return end;
+}
+
+static void text_reserve(s_text * t)
+{
+	if (t->len > TEXT_BUF - TEXT_MAX)
+		text_flush(t);
+}
+
+static void text_put(s_text * t, const char *s, unsigned len, char sep)
+{
+	memcpy(t->buf + t->len, s, len);
+	t->len += len;
+	if (sep)
+		t->buf[t->len++] = sep;
+}
+
+/**
+ * text_open() - start formatting into a file
+ * @t:		formatter
+ * @out:	file, written at text_flush() and text_close(), or NULL to
+ *		discard the values without formatting them
+ **/
+void text_open(s_text * t, FILE * out)
+{
+	t->out = out;
+	t->len = 0;
+}
+
+/**
+ * text_flush() - write out the formatted values
+ * @t:		formatter
+ *
+ * Returns 0 or -EIO.
+ **/
+int text_flush(s_text * t)
+{
+	if (t->out == NULL)
+		return 0;
+	if (t->len && fwrite(t->buf, 1, t->len, t->out) != t->len) {
+		t->len = 0;
+		return -EIO;
+	}
+	t->len = 0;
+
+	return 0;
+}
+
+/**
+ * text_close() - write out the rest
+ * @t:		formatter
+ *
+ * The file stays open. Returns 0 or -EIO, also for earlier write errors.
+ **/
+int text_close(s_text * t)
+{
+	text_flush(t);
+
+	return t->out && ferror(t->out) ? -EIO : 0;
+}
+
+/**
+ * text_char() - a single character
+ * @t:		formatter
+ * @c:		character
+ **/
+void text_char(s_text * t, char c)
+{
+	if (t->out == NULL)
+		return;
+	text_reserve(t);
+	t->buf[t->len++] = c;
+}
+
+/**
+ * text_int() - an integer, as "%lld"
+ * @t:		formatter
+ * @v:		value
+ * @sep:	character after it, or 0 for none
+ **/
+void text_int(s_text * t, long long v, char sep)
+{
+	char tmp[24], *end = tmp + sizeof(tmp), *p;
+
+	if (t->out == NULL)
+		return;
+	text_reserve(t);
+	if (v < 0) {
+		p = text_u64(end, -(unsigned long long)v);
+		*--p = '-';
+	} else {
+		p = text_u64(end, v);
+	}
+	text_put(t, p, end - p, sep);
+}
+
+/**
+ * text_fixed() - a value with a fixed number of decimals, as "%.<prec>f"
+ * @t:		formatter
+ * @v:		value
+ * @prec:	decimals, up to 9
+ * @sep:	character after it, or 0 for none
+ *
+ * Values too large to scale exactly, infinities and NaN, and the rare
+ * scaled value that lands on a rounding tie, which the scaling may have
+ * made one, go through fprintf().
+ **/
+void text_fixed(s_text * t, double v, unsigned prec, char sep)
+{
+	char tmp[TEXT_MAX], *end = tmp + sizeof(tmp), *p;
+	double scaled, r;
+	unsigned long long m, scale;
+
+	if (t->out == NULL)
+		return;
+	text_reserve(t);
+	if (prec >= ARRAY_SIZE(pow10_tab))
+		prec = ARRAY_SIZE(pow10_tab) - 1;
+
+	scaled = fabs(v) * pow10_tab[prec];
+	r = floor(scaled);
+	if (!(scaled < 4e15) || scaled - r == 0.5) {
+		text_flush(t);
+		fprintf(t->out, "%.*f", prec, v);
+		if (sep)
+			fputc(sep, t->out);
+		return;
+	}
+
+	m = (unsigned long long)r + (scaled - r > 0.5);
+	scale = pow10_tab[prec];
+	p = end;
+	if (prec) {
+		p = text_u64_pad(p, m % scale, prec);
+		*--p = '.';
+	}
+	p = text_u64(p, m / scale);
+	/* printf() keeps the sign of values rounding to zero */
+	if (signbit(v))
+		*--p = '-';
+	text_put(t, p, end - p, sep);
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Amplitude and phase of a few known tones, by the Goertzel algorithm
+ * at arbitrary (non bin centred) frequencies. Much cheaper than an
+ * FFT when only a handful of frequencies matter, and there is no plot
+ * to render; the results go straight back as text.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+/**
+ * tone_parse() - read the tone frequency list
+ * @info:	stone.freq and stone.n are set
+ * @list:	frequencies in Hz, separated by spaces or commas
+ *
+ * Returns the number of tones, at most TONE_MAX.
+ **/
+int tone_parse(s_info * info, const char *list)
+{
+	char *end;
+	double f;
+
+	info->stone.n = 0;
+
+	while (*list && info->stone.n < TONE_MAX) {
+		f = strtod(list, &end);
+		if (end == list) {
+			list++;
+			continue;
+		}
+		if (f >= 0)
+			info->stone.freq[info->stone.n++] = f;
+		list = end;
+	}
+
+	return info->stone.n;
+}
+
+/*
+ * Goertzel for all tones at once. The tones are the inner loop, so
+ * the recursion, serial in time, vectorizes across frequencies.
+ * The state is double; a float recursion loses the low tones of long
+ * captures.
+ */
+static void tone_goertzel(double *re, double *im, const float *x, unsigned n,
+			  const double *w, unsigned ntones)
+{
+	double c[TONE_MAX], s1[TONE_MAX], s2[TONE_MAX], s0;
+	unsigned i, t;
+
+	for (t = 0; t < ntones; t++) {
+		c[t] = 2 * cos(w[t]);
+		s1[t] = 0;
+		s2[t] = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		for (t = 0; t < ntones; t++) {
+			s0 = x[i] + c[t] * s1[t] - s2[t];
+			s2[t] = s1[t];
+			s1[t] = s0;
+		}
+	}
+
+	/*
+	 * X(w) = sum x[k] exp(-jwk) = exp(-jw(n-1)) (s1 - exp(-jw) s2)
+	 */
+	for (t = 0; t < ntones; t++) {
+		double yr = s1[t] - cos(w[t]) * s2[t];
+		double yi = sin(w[t]) * s2[t];
+		double ph = -w[t] * (n - 1);
+
+		re[t] = yr * cos(ph) - yi * sin(ph);
+		im[t] = yr * sin(ph) + yi * cos(ph);
+	}
+}
+
+static void tone_capture(s_info * info, s_capture * cap, const char *name,
+			 float *x, FILE * out)
+{
+	double w[TONE_MAX], re[TONE_MAX], im[TONE_MAX], gain, amp;
+	unsigned c, i, t, n = cap->samples;
+
+	for (t = 0; t < info->stone.n; t++)
+		w[t] = 2 * M_PI * info->stone.freq[t] / info->stime_s.sps;
+
+	/* coherent gain, so a sine of amplitude A reads A */
+	gain = info->sdisplay.window ? n / 4.0 : n / 2.0;
+
+	for (c = 0; c < 2; c++) {
+		const short *d = cap->data + (c < cap->samples_per_scan ? c : 0);
+
+		if (!(info->channel_en_mask & (1 << c)) && info->id != ID_AD9250)
+			continue;
+
+		for (i = 0; i < n; i++)
+			x[i] = d[i * cap->samples_per_scan];
+		if (info->sdisplay.window)
+			fwindow(x, n);
+
+		tone_goertzel(re, im, x, n, w, info->stone.n);
+
+		for (t = 0; t < info->stone.n; t++) {
+			amp = hypot(re[t], im[t]) / gain;
+			fprintf(out, "%s %u %.3f %.3f %.2f %.3f\n", name, c,
+				info->stone.freq[t], amp,
+				amp > 0 ? 20 * log10(amp / ADC_FULL_SCALE) : -999.0,
+				atan2(im[t], re[t]) * (180 / M_PI));
+		}
+	}
+}
+
+/**
+ * tone_report() - measure the tones in the retained captures
+ * @info:	settings, stone and scapture[]
+ * @out:	text output, a line per board, channel and tone:
+ *		"board channel Hz amplitude dBFS phase"
+ *
+ * The amplitude is the peak in ADC codes. The phase, in degrees, is
+ * that of a cosine at the first sample, so the difference between
+ * channels or boards is their phase difference.
+ *
+ * Returns 0 on success or a negative errno.
+ **/
+int tone_report(s_info * info, FILE * out)
+{
+	struct timeval start, end;
+	float *x;
+	int b;
+
+	if (info->stone.n == 0 || info->stime_s.sps == 0 ||
+	    info->scapture[0].data == NULL)
+		return -EINVAL;
+
+	x = malloc(info->scapture[0].samples * sizeof(float));
+	if (x == NULL)
+		return -ENOMEM;
+
+	gettimeofday(&start, NULL);
+
+	fprintf(out, "# %u samples @ %u Samples/s, %s window\n",
+		info->scapture[0].samples, info->stime_s.sps,
+		info->sdisplay.window ? "Hanning" : "no");
+	fprintf(out, "# board channel frequency/Hz amplitude dBFS phase/deg\n");
+
+	for (b = 0; b < (info->has_slave ? 2 : 1); b++) {
+		if (info->scapture[b].data == NULL ||
+		    info->scapture[b].samples > info->scapture[0].samples)
+			continue;
+		tone_capture(info, &info->scapture[b], b ? "HPC" : "LPC", x, out);
+	}
+
+	gettimeofday(&end, NULL);
+	fprintf(out, "# %.3f ms\n", (end.tv_sec - start.tv_sec) * 1e3 +
+		(end.tv_usec - start.tv_usec) / 1e3);
+
+	free(x);
+
+	return 0;
+}
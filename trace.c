@@ -0,0 +1,177 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Max hold, min hold and averaged spectrum traces. Each CGI request is
+ * a new process, so the traces live in a small file per client and
+ * device that is mapped and updated in place.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define TRACE_MAGIC	0x3254444e	/* "NDT2", averages in power */
+
+struct trace_header {
+	unsigned magic;
+	unsigned n;
+	unsigned count;
+	unsigned pad;
+};
+
+/*
+ * All three traces are kept up to date on every capture, so switching
+ * the displayed one doesn't lose history. The average is of the power,
+ * not of the dB values, which would read low on noise; it is kept
+ * linear and only converted to dB for display.
+ */
+static void trace_accumulate(float *max, float *min, float *avg,
+			     const float *db, unsigned n, unsigned count,
+			     unsigned mode, unsigned navg)
+{
+	float k;
+	unsigned i;
+
+	if (count == 0) {
+		memcpy(max, db, n * sizeof(float));
+		memcpy(min, db, n * sizeof(float));
+		for (i = 0; i < n; i++)
+			avg[i] = powf(10.0f, 0.1f * db[i]);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		max[i] = db[i] > max[i] ? db[i] : max[i];
+
+	for (i = 0; i < n; i++)
+		min[i] = db[i] < min[i] ? db[i] : min[i];
+
+	if (mode == HOLD_LIN_AVG || navg < 1)
+		k = 1.0f / (count + 1);
+	else
+		k = 1.0f / navg;
+
+	for (i = 0; i < n; i++)
+		avg[i] += (powf(10.0f, 0.1f * db[i]) - avg[i]) * k;
+}
+
+/**
+ * trace_update() - add a spectrum to the held traces
+ * @info:	settings; sdisplay.hold selects the trace, holdavg the
+ *		exponential average length, holdreset starts over
+ * @device:	device the spectrum came from, traces are kept per device
+ * @db:		spectrum in dB, n bins
+ * @hold:	returns the selected trace, n bins
+ * @n:		number of bins
+ *
+ * The traces restart whenever the number of bins changes.
+ * Returns the number of spectra in the trace, or a negative errno;
+ * @hold is a copy of @db then.
+ **/
+int trace_update(s_info * info, const char *device, const float *db,
+		 float *hold, unsigned n)
+{
+	struct trace_header *hdr;
+	char *filename;
+	size_t len = sizeof(*hdr) + 3 * n * sizeof(float);
+	float *max, *min, *avg;
+	unsigned i;
+	int fd, ret;
+
+	memcpy(hold, db, n * sizeof(float));
+
+	if (asprintf(&filename, "%s%s_%s", FILENAME_TRACE,
+		     info->pREMOTE_ADDR, device) < 0)
+		return -ENOMEM;
+
+	fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		ret = -errno;
+		syslog(LOG_INFO, "Failed to open %s\n", filename);
+		free(filename);
+		return ret;
+	}
+	free(filename);
+
+	flock(fd, LOCK_EX);
+
+	if (ftruncate(fd, len) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	if (info->sdisplay.holdreset || hdr->magic != TRACE_MAGIC ||
+	    hdr->n != n) {
+		hdr->magic = TRACE_MAGIC;
+		hdr->n = n;
+		hdr->count = 0;
+	}
+
+	max = (float *)(hdr + 1);
+	min = max + n;
+	avg = min + n;
+
+	trace_accumulate(max, min, avg, db, n, hdr->count,
+			 info->sdisplay.hold, info->sdisplay.holdavg);
+	hdr->count++;
+
+	switch (info->sdisplay.hold) {
+	case HOLD_MAX:
+		memcpy(hold, max, n * sizeof(float));
+		break;
+	case HOLD_MIN:
+		memcpy(hold, min, n * sizeof(float));
+		break;
+	default:
+		for (i = 0; i < n; i++)
+			hold[i] = 10.0f * log10f(avg[i]);
+		break;
+	}
+	ret = hdr->count;
+
+	munmap(hdr, len);
+	close(fd);
+
+	return ret;
+}
+
+/**
+ * trace_name() - legend title of the held trace
+ * @info:	settings
+ **/
+const char *trace_name(s_info * info)
+{
+	switch (info->sdisplay.hold) {
+	case HOLD_MAX:
+		return "Max Hold";
+	case HOLD_MIN:
+		return "Min Hold";
+	case HOLD_EXP_AVG:
+		return "Exp Avg";
+	case HOLD_LIN_AVG:
+		return "Lin Avg";
+	default:
+		return "";
+	}
+}
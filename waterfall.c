@@ -0,0 +1,238 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Spectrogram (waterfall) display. A short-time FFT slides over the
+ * capture, each frame becomes one row of colour indices, and the rows
+ * are appended to a per session ring file, so every ACQUIRE only pays
+ * for the frames of its own capture. The image is rendered straight
+ * from the ring through a palette.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define WF_ROWS		256	/* rows kept, newest on top */
+#define WF_MAX_COLS	1024	/* bins are max-reduced to this width */
+#define WF_DB_MIN	(-140.0f)	/* maps to colour 0, 0 dB to 255 */
+#define WF_MAGIC	0x4657444e	/* "NDWF" */
+
+struct wf_header {
+	unsigned magic;
+	unsigned cols;
+	unsigned nfft;
+	unsigned sps;
+	unsigned head;
+	unsigned count;
+};
+
+static unsigned char palette[256][3];
+
+static int wf_open(s_info * info, struct wf_header *hdr, unsigned cols,
+		   unsigned nfft)
+{
+	int fd;
+
+	fd = open(info->pFILENAME_WF, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -errno;
+
+	flock(fd, LOCK_EX);
+
+	if (info->sdisplay.wfclear ||
+	    pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+	    hdr->magic != WF_MAGIC || hdr->cols != cols ||
+	    hdr->nfft != nfft || hdr->sps != info->stime_s.sps) {
+		hdr->magic = WF_MAGIC;
+		hdr->cols = cols;
+		hdr->nfft = nfft;
+		hdr->sps = info->stime_s.sps;
+		hdr->head = 0;
+		hdr->count = 0;
+		/* truncate first, so old rows read back as zeros */
+		if (ftruncate(fd, 0) < 0 ||
+		    ftruncate(fd, sizeof(*hdr) + WF_ROWS * cols) < 0) {
+			close(fd);
+			return -errno;
+		}
+	}
+
+	return fd;
+}
+
+static int wf_render(s_info * info, int fd, struct wf_header *hdr)
+{
+	unsigned char *rows, *rgb, *p;
+	unsigned y, x, r;
+	int ret;
+
+	rows = malloc(WF_ROWS * hdr->cols * 4);
+	if (rows == NULL)
+		return -ENOMEM;
+	rgb = rows + WF_ROWS * hdr->cols;
+
+	if (pread(fd, rows, WF_ROWS * hdr->cols, sizeof(*hdr)) < 0) {
+		free(rows);
+		return -errno;
+	}
+
+	if (!palette[255][0])
+		image_palette(palette);
+
+	for (y = 0, p = rgb; y < WF_ROWS; y++) {
+		r = (hdr->head + WF_ROWS - 1 - y) % WF_ROWS;
+		for (x = 0; x < hdr->cols; x++, p += 3)
+			memcpy(p, palette[rows[r * hdr->cols + x]], 3);
+	}
+
+	ret = image_write_bmp(info->pFILENAME_WF_IMG, rgb, hdr->cols, WF_ROWS);
+
+	free(rows);
+
+	return ret;
+}
+
+/**
+ * waterfall_sample() - STFT of a capture, appended to the waterfall
+ * @info:	settings; stime_s, sdisplay and the session file names
+ * @data:	interleaved capture, samples_per_scan values per sample
+ * @samples_per_scan: values per sample in @data
+ * @out:	file the "frequency dB" pairs of the newest frame go to
+ * @update:	append to the waterfall and render it; 0 only writes @out
+ * @mk:		markers of the newest frame, if enabled
+ *
+ * Frames of 1 << fsamples points overlap by half; fsamples 0 makes
+ * the whole capture a single frame. Only the newest
+ * WF_ROWS frames of a capture are computed, older ones would scroll
+ * out of the image anyway. Channel mask 3 is complex I/Q input.
+ *
+ * Returns 0 on success or a negative errno.
+ **/
+int waterfall_sample(s_info * info, short *data, unsigned samples_per_scan,
+		     FILE * out, int update, s_markers * mk)
+{
+	unsigned n = info->stime_s.samples;
+	unsigned nfft = info->stime_s.fsamples ? 1 << info->stime_s.fsamples : n;
+	unsigned hop, frames, first, cols, group, f, i, k;
+	unsigned char *row;
+	float *fr, *fi, *pwr, v;
+	struct wf_header hdr;
+	int fd = -1, ret = 0;
+	s_text text;
+
+	while (nfft > n && nfft > 2)
+		nfft >>= 1;
+	hop = nfft / 2;
+	frames = (n - nfft) / hop + 1;
+	first = (update && frames > WF_ROWS) ? frames - WF_ROWS : 0;
+	if (!update)
+		first = frames - 1;
+
+	cols = nfft / 2;
+	for (group = 1; cols / group > WF_MAX_COLS; group <<= 1) ;
+	cols /= group;
+
+	fr = malloc((2 * nfft + nfft / 2) * sizeof(float) + cols);
+	if (fr == NULL)
+		return -ENOMEM;
+	fi = fr + nfft;
+	pwr = fi + nfft;
+	row = (unsigned char *)(pwr + nfft / 2);
+
+	if (update) {
+		fd = wf_open(info, &hdr, cols, nfft);
+		if (fd < 0) {
+			syslog(LOG_INFO, "Failed to open %s\n", info->pFILENAME_WF);
+			update = 0;
+		}
+	}
+
+	for (f = first; f < frames; f++) {
+		short *d = data + f * hop * samples_per_scan;
+
+		switch (info->channel_en_mask) {
+		case 3:
+			for (i = 0; i < nfft; i++) {
+				fr[i] = d[i * samples_per_scan];
+				fi[i] = d[i * samples_per_scan + 1];
+			}
+			break;
+		case 2:
+			for (i = 0; i < nfft; i++) {
+				fr[i] = d[i * samples_per_scan + 1];
+				fi[i] = 0;
+			}
+			break;
+		default:
+			for (i = 0; i < nfft; i++) {
+				fr[i] = d[i * samples_per_scan];
+				fi[i] = 0;
+			}
+			break;
+		}
+
+		if (info->sdisplay.window) {
+			fwindow(fr, nfft);
+			fwindow(fi, nfft);
+		}
+
+		cfft(fr, fi, nfft, 0);
+
+		/* same scaling as the Q15 path, fix_fft() divides by N */
+		for (i = 0; i < nfft / 2; i++)
+			pwr[i] = (fr[i] * fr[i] + fi[i] * fi[i]) /
+				((float)nfft * nfft);
+		power_db(pwr, pwr, nfft / 2, fix_loud_offset(2));
+
+		if (update) {
+			for (i = 0; i < cols; i++) {
+				v = pwr[i * group];
+				for (k = 1; k < group; k++)
+					if (pwr[i * group + k] > v)
+						v = pwr[i * group + k];
+				v = (v - WF_DB_MIN) * (255.0f / -WF_DB_MIN);
+				row[i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+			}
+			pwrite(fd, row, cols, sizeof(hdr) + hdr.head * cols);
+			hdr.head = (hdr.head + 1) % WF_ROWS;
+			if (hdr.count < WF_ROWS)
+				hdr.count++;
+		}
+	}
+
+	/* the plot shows the newest frame */
+	text_open(&text, out);
+	for (i = info->sdisplay.fftexludezero; i < nfft / 2; i++) {
+		text_fixed(&text, (double)i * info->stime_s.sps / nfft, 6, ' ');
+		text_fixed(&text, pwr[i], 2, '\n');
+	}
+	text_close(&text);
+
+	if (info->smarker.n)
+		marker_find(mk, pwr, nfft / 2, nfft, &info->smarker, 0,
+			    (double)info->stime_s.sps / nfft);
+
+	if (update) {
+		pwrite(fd, &hdr, sizeof(hdr), 0);
+		ret = wf_render(info, fd, &hdr);
+		close(fd);
+	}
+
+	info->swaterfall.nfft = nfft;
+	info->swaterfall.frames = frames - first;
+
+	free(fr);
+
+	return ret;
+}
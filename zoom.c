@@ -0,0 +1,336 @@
+/*
+ * Copyright 2012 Analog Devices Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Zoom FFT: a digital down converter (NCO mixer, CIC decimator and a
+ * CIC compensating FIR decimating by two) followed by a small FFT of
+ * the baseband around the zoom centre.
+ *
+ * All stages work on separate I and Q arrays in blocks, with no
+ * per-sample branches, so the compiler can vectorize them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#include "ndso.h"
+
+#define NCO_BLOCK	64	/* samples per exactly computed NCO phase */
+#define CIC_ORDER	4
+#define CIC_MAX_R	1024	/* keeps 18 + 4 * log2(R) bits below 64 */
+#define CIC_SCALE	4	/* fractional bits kept when quantizing */
+#define FIR_TAPS	63
+#define FIR_BETA	9.0	/* Kaiser window, ~90 dB stop band */
+#define ZOOM_OSR	1.25	/* output rate / span */
+#define ZOOM_MIN_LEN	8	/* samples after decimation, fewer are no spectrum */
+
+/*
+ * NCO mixer: (xr + j xi) * exp(-j 2 pi fc/fs n).
+ * The phase is recomputed exactly once per block and the per-sample
+ * rotation comes from a table, so there is neither drift nor a
+ * recurrence that blocks vectorization.
+ */
+static void nco_mix(float *ir, float *qr, const float *xr, const float *xi,
+		    int n, double w)
+{
+	float rc[NCO_BLOCK], rs[NCO_BLOCK];
+	int i, k, len;
+
+	for (k = 0; k < NCO_BLOCK; k++) {
+		rc[k] = cos(w * k);
+		rs[k] = -sin(w * k);
+	}
+
+	for (i = 0; i < n; i += NCO_BLOCK) {
+		double ph = fmod(w * i, 2 * M_PI);
+		float pc = cos(ph), ps = -sin(ph);
+
+		len = (n - i) < NCO_BLOCK ? (n - i) : NCO_BLOCK;
+
+		for (k = 0; k < len; k++) {
+			float c = pc * rc[k] - ps * rs[k];
+			float s = pc * rs[k] + ps * rc[k];
+			float a = xr[i + k], b = xi ? xi[i + k] : 0;
+
+			ir[i + k] = a * c - b * s;
+			qr[i + k] = a * s + b * c;
+		}
+	}
+}
+
+/*
+ * CIC decimator, CIC_ORDER stages, differential delay 1.
+ * Integer arithmetic wraps modulo 2^64, which is exactly what the
+ * integrator/comb structure needs; the output is normalized to unity
+ * DC gain. The first CIC_ORDER outputs, while the combs fill, are
+ * dropped. Returns the number of output samples.
+ */
+static int cic_decimate(float *out, const float *in, int n, int r)
+{
+	uint64_t integ[CIC_ORDER], comb[CIC_ORDER];
+	uint64_t v, t;
+	float gain = 1.0f / (CIC_SCALE * powf(r, CIC_ORDER));
+	int i, s, cnt = 0, settle = CIC_ORDER;
+
+	memset(integ, 0, sizeof(integ));
+	memset(comb, 0, sizeof(comb));
+
+	for (i = 0; i < n; i++) {
+		v = (uint64_t)(int64_t)lrintf(in[i] * CIC_SCALE);
+		for (s = 0; s < CIC_ORDER; s++)
+			v = integ[s] += v;
+
+		if ((i + 1) % r)
+			continue;
+
+		for (s = 0; s < CIC_ORDER; s++) {
+			t = v;
+			v -= comb[s];
+			comb[s] = t;
+		}
+		if (settle)
+			settle--;
+		else
+			out[cnt++] = (float)(int64_t)v * gain;
+	}
+
+	return cnt;
+}
+
+/* zeroth order modified Bessel function, for the Kaiser window */
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	int k;
+
+	for (k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+/*
+ * Low pass with cutoff at a quarter of its input rate, whose pass band
+ * is the inverse of the CIC droop. Designed by frequency sampling and
+ * Kaiser windowed. Taps are normalized to unity DC gain.
+ */
+static void fir_design(float *h, int r)
+{
+	const int grid = 512;
+	double c = (FIR_TAPS - 1) / 2.0, sum = 0, d, nu, x;
+	int n, k;
+
+	for (n = 0; n < FIR_TAPS; n++) {
+		double acc = 0;
+
+		for (k = 0; k <= grid / 2; k++) {
+			nu = 0.25 * k / (grid / 2);
+			/* CIC response at nu (cycles per CIC output sample) */
+			if (k == 0 || r == 1) {
+				d = 1;
+			} else {
+				x = sin(M_PI * nu) / (r * sin(M_PI * nu / r));
+				d = 1 / pow(fabs(x), CIC_ORDER);
+			}
+			acc += (k == 0 || k == grid / 2 ? 0.5 : 1) * d *
+				cos(2 * M_PI * nu * (n - c));
+		}
+
+		x = (n - c) / c;
+		h[n] = acc * bessel_i0(FIR_BETA * sqrt(1 - x * x)) /
+			bessel_i0(FIR_BETA);
+		sum += h[n];
+	}
+
+	for (n = 0; n < FIR_TAPS; n++)
+		h[n] /= sum;
+}
+
+/* FIR decimate by two; returns the number of output samples */
+static int fir_decimate2(float *out, const float *in, int n, const float *h)
+{
+	int i, k, cnt = 0;
+
+	for (i = 0; i + FIR_TAPS <= n; i += 2) {
+		float acc = 0;
+
+		for (k = 0; k < FIR_TAPS; k++)
+			acc += h[k] * in[i + k];
+		out[cnt++] = acc;
+	}
+
+	return cnt;
+}
+
+/**
+ * zoom_sample() - zoom FFT of a capture
+ * @info:	settings; szoom, stime_s and sdisplay are used
+ * @device_name: device the capture came from, for the held trace
+ * @data:	interleaved capture, samples_per_scan values per sample
+ * @samples_per_scan: values per sample in @data
+ * @out:	file the "frequency dB [held dB]" lines of the zoom span go to
+ * @mk:		markers of the zoom span, if enabled
+ *
+ * Channel mask 3 is treated as complex I/Q input, like the regular
+ * FFT path. The FFT length is 1 << fsamples, zero padded if the
+ * capture is too short to fill it after decimation; with fsamples 0
+ * it is the number of samples left after decimation, whatever it is.
+ * check_request() bounds fsamples as for the regular FFT.
+ *
+ * Returns 0 on success, -EINVAL without sample rate or span, -ERANGE if
+ * the span is too narrow for the capture depth, or -ENOMEM.
+ **/
+int zoom_sample(s_info * info, char *device_name, short *data,
+		unsigned samples_per_scan, FILE * out, s_markers * mk)
+{
+	unsigned n = info->stime_s.samples;
+	unsigned nfft = info->stime_s.fsamples ? 1 << info->stime_s.fsamples : n;
+	double fs = info->stime_s.sps, fout, f;
+	float *xr, *xi, *ir, *qr, *fr, *fi, *pwr, *hold, h[FIR_TAPS];
+	int i, r, cnt, dec, lo, hi;
+	s_text text;
+
+	if (fs <= 0 || info->szoom.span <= 0)
+		return -EINVAL;
+
+	/* total decimation 2 * r, the FIR stage always halves the rate */
+	dec = fs / (ZOOM_OSR * info->szoom.span);
+	r = dec / 2;
+	if (r < 1)
+		r = 1;
+	if (r > CIC_MAX_R)
+		r = CIC_MAX_R;
+
+	xr = malloc((5 * n + 4 * nfft) * sizeof(float));
+	if (xr == NULL)
+		return -ENOMEM;
+	xi = xr + n;
+	ir = xi + n;
+	qr = ir + n;
+	fr = qr + n;
+	fi = fr + nfft;
+	pwr = fi + nfft;
+	hold = pwr + nfft;
+
+	switch (info->channel_en_mask) {
+	case 3:
+		for (i = 0; i < n; i++) {
+			xr[i] = data[i * samples_per_scan];
+			xi[i] = data[i * samples_per_scan + 1];
+		}
+		break;
+	case 2:
+		for (i = 0; i < n; i++)
+			xr[i] = data[i * samples_per_scan + 1];
+		xi = NULL;
+		break;
+	default:
+		for (i = 0; i < n; i++)
+			xr[i] = data[i * samples_per_scan];
+		xi = NULL;
+		break;
+	}
+
+	nco_mix(ir, qr, xr, xi, n, 2 * M_PI * info->szoom.centre / fs);
+
+	/* CIC, then compensating FIR; both run in place */
+	cnt = n;
+	if (r > 1) {
+		cic_decimate(ir, ir, n, r);
+		cnt = cic_decimate(qr, qr, n, r);
+	}
+	fir_design(h, r);
+	fir_decimate2(ir, ir, cnt, h);
+	cnt = fir_decimate2(qr, qr, cnt, h);
+	fout = fs / (2 * r);
+
+	/* the FIR needs FIR_TAPS samples per output */
+	if (cnt < ZOOM_MIN_LEN) {
+		free(xr);
+		return -ERANGE;
+	}
+
+	/* a depth FFT transforms what is left after decimation */
+	if (!info->stime_s.fsamples)
+		nfft = cnt;
+	if (cnt > nfft)
+		cnt = nfft;
+
+	/* zero padded to nfft */
+	memcpy(fr, ir, cnt * sizeof(float));
+	memcpy(fi, qr, cnt * sizeof(float));
+	memset(fr + cnt, 0, (nfft - cnt) * sizeof(float));
+	memset(fi + cnt, 0, (nfft - cnt) * sizeof(float));
+
+	if (info->sdisplay.window) {
+		fwindow(fr, cnt);
+		fwindow(fi, cnt);
+	}
+
+	if (cfft(fr, fi, nfft, 0) < 0) {
+		free(xr);
+		return -ENOMEM;
+	}
+
+	/*
+	 * Same scaling as the Q15 path, where fix_fft() divides by N;
+	 * here N is the number of samples before zero padding.
+	 */
+	for (i = 0; i < nfft; i++)
+		pwr[i] = (fr[i] * fr[i] + fi[i] * fi[i]) /
+			((float)cnt * cnt);
+	power_db(pwr, pwr, nfft, fix_loud_offset(2));
+
+	if (info->sdisplay.hold)
+		info->hold_count = trace_update(info, device_name, pwr, hold, nfft);
+
+	/* negative frequencies first */
+	text_open(&text, out);
+	for (i = 0; i < nfft; i++) {
+		int k = (i + (nfft + 1) / 2) % nfft;
+
+		f = (i - (int)nfft / 2) * fout / nfft;
+		if (fabs(f) > info->szoom.span / 2)
+			continue;
+		text_fixed(&text, info->szoom.centre + f, 6, ' ');
+		if (info->sdisplay.hold) {
+			text_fixed(&text, pwr[k], 2, ' ');
+			text_fixed(&text, hold[k], 2, '\n');
+		} else {
+			text_fixed(&text, pwr[k], 2, '\n');
+		}
+	}
+	text_close(&text);
+
+	if (info->smarker.n) {
+		/* the span, negative frequencies first, freed FFT buffer */
+		for (i = 0; i < nfft; i++)
+			fr[i] = pwr[(i + (nfft + 1) / 2) % nfft];
+		lo = ceil(nfft / 2 - info->szoom.span / 2 * nfft / fout);
+		hi = floor(nfft / 2 + info->szoom.span / 2 * nfft / fout);
+		if (lo < 0)
+			lo = 0;
+		if (hi > nfft - 1)
+			hi = nfft - 1;
+		marker_find(mk, fr + lo, hi - lo + 1, 0, &info->smarker,
+			    info->szoom.centre + (lo - (int)nfft / 2) * fout / nfft,
+			    fout / nfft);
+	}
+
+	info->szoom.rate = fout;
+	info->szoom.len = cnt;
+	info->szoom.nfft = nfft;
+
+	free(xr);
+
+	return 0;
+}